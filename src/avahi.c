@@ -31,29 +31,234 @@
 #include <stdio.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <unistd.h>
 #include <string.h>
 #include <pthread.h>
+#include <net/if.h>
 #include <avahi-client/client.h>
 #include <avahi-client/lookup.h>
 #include <avahi-common/simple-watch.h>
 #include <avahi-common/malloc.h>
 #include <avahi-common/error.h>
 #include <avahi-common/timeval.h>
+#include <avahi-common/strlst.h>
 #include <lxi.h>
 #include "error.h"
+#include "mdns.h"
 #include "avahi.h"
+#include "until.h"
 
-static AvahiSimplePoll *simple_poll = NULL;
-static const AvahiPoll *poll_api = NULL;
-static AvahiServiceBrowser *sb[10] = {};
-static lxi_info_t *lxi_info;
-static int count = 0;
+#define SERVICE_BROWSERS_MAX 5
+#define ADDRESS_LENGTH_MAX (AVAHI_ADDRESS_STR_MAX + IF_NAMESIZE + 1) // Room for IPv6 scope
+
+// Resolved service, remembered while watching to report its removal
+typedef struct avahi_service
+{
+    AvahiIfIndex interface;
+    AvahiProtocol protocol;
+    char *name;
+    char *type;
+    char address[ADDRESS_LENGTH_MAX];
+    uint16_t port;
+    struct avahi_service *next;
+} avahi_service_t;
+
+// State of one discovery or watch, so several may run at the same time
+typedef struct
+{
+    AvahiSimplePoll *simple_poll;
+    const AvahiPoll *poll_api;
+    AvahiClient *client;
+    AvahiServiceBrowser *sb[SERVICE_BROWSERS_MAX];
+    int count;
+    AvahiIfIndex interface;
+    AvahiProtocol protocol;
+    lxi_info_t *info;
+    lxi_mdns_info_t *mdns_info;
+    mdns_watch_t *watch;
+    int interval;
+    avahi_service_t *services;
+    int resolving;
+    int all_for_now;
+    int status;
+} avahi_context_t;
+
+static const char *service_type_name(const char *type)
+{
+    // Pretty print service type
+    if (strcmp(type, "_lxi._tcp") == 0)
+        return "lxi";
+    else if (strcmp(type, "_vxi-11._tcp") == 0)
+        return "vxi-11";
+    else if (strcmp(type, "_scpi-raw._tcp") == 0)
+        return "scpi-raw";
+    else if (strcmp(type, "_scpi-telnet._tcp") == 0)
+        return "scpi-telnet";
+    else if (strcmp(type, "_hislip._tcp") == 0)
+        return "hislip";
+
+    return "Unknown";
+}
+
+static AvahiProtocol avahi_protocol(lxi_family_t family)
+{
+    switch (family)
+    {
+        case FAMILY_IPV6:
+            return AVAHI_PROTO_INET6;
+        case FAMILY_ANY:
+            return AVAHI_PROTO_UNSPEC;
+        default:
+            return AVAHI_PROTO_INET;
+    }
+}
+
+static void address_print(char *buffer, size_t size, const AvahiAddress *address, AvahiIfIndex interface)
+{
+    const uint8_t *ipv6 = address->data.ipv6.address;
+    char ifname[IF_NAMESIZE];
+    size_t length;
+
+    avahi_address_snprint(buffer, size, address);
+
+    // Link-local IPv6 address is only usable along with its interface
+    if ((address->proto == AVAHI_PROTO_INET6) && (ipv6[0] == 0xfe) && ((ipv6[1] & 0xc0) == 0x80) &&
+        (if_indextoname(interface, ifname) != NULL))
+    {
+        length = strlen(buffer);
+        snprintf(buffer + length, size - length, "%%%s", ifname);
+    }
+}
+
+static avahi_service_t **service_find(avahi_context_t *context, AvahiIfIndex interface,
+        AvahiProtocol protocol, const char *name, const char *type)
+{
+    avahi_service_t **link;
+
+    for (link = &context->services; *link != NULL; link = &(*link)->next)
+    {
+        if (((*link)->interface == interface) && ((*link)->protocol == protocol) &&
+            (strcmp((*link)->name, name) == 0) && (strcmp((*link)->type, type) == 0))
+            break;
+    }
+
+    return link;
+}
+
+static void service_free(avahi_service_t *service)
+{
+    free(service->name);
+    free(service->type);
+    free(service);
+}
+
+static void service_resolved(avahi_context_t *context, AvahiIfIndex interface, AvahiProtocol protocol,
+        const char *name, const char *type, const char *address, uint16_t port, AvahiStringList *txt)
+{
+    avahi_service_t **link;
+    avahi_service_t *service;
+    mdns_txt_t items;
+
+    // Nothing more to report once caller has found what it looks for
+    if (until_reached())
+        return;
+
+    // Notify one-shot discovery
+    if (context->info != NULL)
+    {
+        if (context->info->service != NULL)
+            context->info->service(address, name, service_type_name(type), port);
+        return;
+    }
+
+    // Notify one-shot discovery along with TXT record
+    if (context->mdns_info != NULL)
+    {
+        if (context->mdns_info->service == NULL)
+            return;
+
+        memset(&items, 0, sizeof(items));
+        for (; txt != NULL; txt = avahi_string_list_get_next(txt))
+        {
+            if (mdns_txt_add(&items, (const char *) avahi_string_list_get_text(txt),
+                        avahi_string_list_get_size(txt)) != 0)
+                break;
+        }
+
+        context->mdns_info->service(address, name, service_type_name(type), port, items.items, items.count);
+        mdns_txt_free(&items);
+        return;
+    }
+
+    // Remember service to be able to report it gone by name later
+    link = service_find(context, interface, protocol, name, type);
+    if (*link == NULL)
+    {
+        service = calloc(1, sizeof(avahi_service_t));
+        if (service == NULL)
+            return;
+
+        service->name = strdup(name);
+        service->type = strdup(type);
+        if ((service->name == NULL) || (service->type == NULL))
+        {
+            service_free(service);
+            return;
+        }
+        service->interface = interface;
+        service->protocol = protocol;
+        *link = service;
+    }
+    service = *link;
+
+    strncpy(service->address, address, sizeof(service->address) - 1);
+    service->port = port;
+
+    context->watch->service(context->watch->userdata, LXI_ADDED, address, name, service_type_name(type), port);
+}
+
+static void service_removed(avahi_context_t *context, AvahiIfIndex interface, AvahiProtocol protocol,
+        const char *name, const char *type)
+{
+    avahi_service_t **link;
+    avahi_service_t *service;
+
+    if (context->watch == NULL)
+        return;
+
+    // Services never resolved were never reported either
+    link = service_find(context, interface, protocol, name, type);
+    if (*link == NULL)
+        return;
+
+    service = *link;
+    *link = service->next;
+
+    context->watch->service(context->watch->userdata, LXI_REMOVED, service->address, service->name,
+            service_type_name(service->type), service->port);
+
+    service_free(service);
+}
+
+// One-shot discovery ends early when caller has found what it looks for
+static void avahi_check_until(avahi_context_t *context)
+{
+    if (context->watch != NULL)
+        return;
+
+    // Every browser has gone through the cache and waited for the network
+    if ((context->all_for_now == context->count) && (context->resolving == 0))
+        until_settled();
+
+    if (until_reached())
+        avahi_simple_poll_quit(context->simple_poll);
+}
 
 static void avahi_resolve_callback(
         AvahiServiceResolver *r,
-        AVAHI_GCC_UNUSED AvahiIfIndex interface,
-        AVAHI_GCC_UNUSED AvahiProtocol protocol,
+        AvahiIfIndex interface,
+        AvahiProtocol protocol,
         AvahiResolverEvent event,
         const char *name,
         const char *type,
@@ -63,8 +268,10 @@ static void avahi_resolve_callback(
         uint16_t port,
         AvahiStringList *txt,
         AvahiLookupResultFlags flags,
-        AVAHI_GCC_UNUSED void* userdata)
+        void* userdata)
 {
+    avahi_context_t *context = userdata;
+
     assert(r);
 
     /* Called whenever a service has been resolved successfully or timed out */
@@ -76,27 +283,16 @@ static void avahi_resolve_callback(
             break;
         case AVAHI_RESOLVER_FOUND:
             {
-                char addr[AVAHI_ADDRESS_STR_MAX] = "Unknown";
-                char *service_type = "Unknown";
-
-                // Pretty print service type
-                if (strcmp(type, "_lxi._tcp") == 0)
-                    service_type = "lxi";
-                else if (strcmp(type, "_vxi-11._tcp") == 0)
-                    service_type = "vxi-11";
-                else if (strcmp(type, "_scpi-raw._tcp") == 0)
-                    service_type = "scpi-raw";
-                else if (strcmp(type, "_scpi-telnet._tcp") == 0)
-                    service_type = "scpi-telnet";
-                else if (strcmp(type, "_hislip._tcp") == 0)
-                    service_type = "hislip";
-
-                avahi_address_snprint(addr, sizeof(addr), address);
-                if (lxi_info->service != NULL)
-                    lxi_info->service(addr, (char *) name, service_type, port);
+                char addr[ADDRESS_LENGTH_MAX] = "Unknown";
+
+                address_print(addr, sizeof(addr), address, interface);
+                service_resolved(context, interface, protocol, name, type, addr, port, txt);
             }
     }
     avahi_service_resolver_free(r);
+
+    context->resolving--;
+    avahi_check_until(context);
 }
 
 static void avahi_browse_callback(
@@ -110,7 +306,7 @@ static void avahi_browse_callback(
         AVAHI_GCC_UNUSED AvahiLookupResultFlags flags,
         void* userdata)
 {
-    AvahiClient *c = userdata;
+    avahi_context_t *context = userdata;
 
     assert(b);
 
@@ -119,110 +315,189 @@ static void avahi_browse_callback(
     {
         case AVAHI_BROWSER_FAILURE:
             error_printf("(Avahi) %s\n", avahi_strerror(avahi_client_errno(avahi_service_browser_get_client(b))));
-            avahi_simple_poll_quit(simple_poll);
+            context->status = 1;
+            avahi_simple_poll_quit(context->simple_poll);
             return;
         case AVAHI_BROWSER_NEW:
-            if (!(avahi_service_resolver_new(c, interface, protocol, name, type, domain, AVAHI_PROTO_INET, 0, avahi_resolve_callback, c)))
-                error_printf("Avahi failed to resolve service '%s': %s\n", name, avahi_strerror(avahi_client_errno(c)));
+            if (!(avahi_service_resolver_new(context->client, interface, protocol, name, type, domain, context->protocol, 0, avahi_resolve_callback, context)))
+                error_printf("Avahi failed to resolve service '%s': %s\n", name, avahi_strerror(avahi_client_errno(context->client)));
+            else
+                context->resolving++;
             break;
         case AVAHI_BROWSER_REMOVE:
+            service_removed(context, interface, protocol, name, type);
+            break;
         case AVAHI_BROWSER_ALL_FOR_NOW:
+            context->all_for_now++;
+            avahi_check_until(context);
+            break;
         case AVAHI_BROWSER_CACHE_EXHAUSTED:
+            // Cached services are being resolved, network may still answer
             break;
     }
 }
 
-static void avahi_client_callback(AvahiClient *c, AvahiClientState state, AVAHI_GCC_UNUSED void * userdata)
+static void avahi_client_callback(AvahiClient *c, AvahiClientState state, void * userdata)
 {
+    avahi_context_t *context = userdata;
+
     assert(c);
 
     /* Called whenever the client or server state changes */
     if (state == AVAHI_CLIENT_FAILURE)
     {
         error_printf("Avahi server connection failure: %s\n", avahi_strerror(avahi_client_errno(c)));
-        avahi_simple_poll_quit(simple_poll);
+        context->status = 1;
+        avahi_simple_poll_quit(context->simple_poll);
     }
 }
 
-static int create_service_browser(AvahiClient *client, char *service)
+static int create_service_browser(avahi_context_t *context, const char *service)
 {
-    if (!(sb[count++] = avahi_service_browser_new(client, AVAHI_IF_UNSPEC, AVAHI_PROTO_INET, service, NULL, 0, avahi_browse_callback, client)))
+    AvahiServiceBrowser *sb;
+
+    sb = avahi_service_browser_new(context->client, context->interface, context->protocol, service, NULL, 0, avahi_browse_callback, context);
+    if (!sb)
     {
-        error_printf("Failed to create Avahi service browser: %s\n", avahi_strerror(avahi_client_errno(client)));
+        error_printf("Failed to create Avahi service browser: %s\n", avahi_strerror(avahi_client_errno(context->client)));
         return 1;
     }
+    context->sb[context->count++] = sb;
     return 0;
 }
 
-static void avahi_terminate(AVAHI_GCC_UNUSED AvahiTimeout *timeout, AVAHI_GCC_UNUSED void *userdata)
+static void avahi_terminate(AVAHI_GCC_UNUSED AvahiTimeout *timeout, void *userdata)
+{
+    avahi_context_t *context = userdata;
+
+    avahi_simple_poll_quit(context->simple_poll);
+}
+
+static void avahi_check_cancelled(AvahiTimeout *timeout, void *userdata)
 {
-    avahi_simple_poll_quit(simple_poll);
+    avahi_context_t *context = userdata;
+    struct timeval tv;
+
+    if (context->watch->cancelled(context->watch->userdata))
+    {
+        avahi_simple_poll_quit(context->simple_poll);
+        return;
+    }
+
+    avahi_elapse_time(&tv, context->interval, 0);
+    context->poll_api->timeout_update(timeout, &tv);
 }
 
-int avahi_discover(lxi_info_t *info, int timeout)
+// Browse for LXI services until timeout expires or watch is cancelled
+static int avahi_browse(avahi_context_t *context, int timeout, AvahiTimeoutCallback callback)
 {
-    AvahiClient *client = NULL;
     struct timeval tv;
     int status = 1;
     int error;
 
-    /* Setup callback structure and timeout for avahi service callback */
-    lxi_info = info;
-
     /* Allocate main loop object */
-    simple_poll = avahi_simple_poll_new();
-    if (!simple_poll)
+    context->simple_poll = avahi_simple_poll_new();
+    if (!context->simple_poll)
     {
         error_printf("Failed to create simple Avahi poll object.\n");
         goto fail;
     }
 
     /* Get poll API object for configuration of Avahi poll loop */
-    poll_api = avahi_simple_poll_get(simple_poll);
-    if (!poll_api)
+    context->poll_api = avahi_simple_poll_get(context->simple_poll);
+    if (!context->poll_api)
     {
         error_printf("Failed to create Avahi poll API object.\n");
         goto fail;
     }
 
     /* Allocate a new client */
-    client = avahi_client_new(avahi_simple_poll_get(simple_poll), 0, avahi_client_callback, NULL, &error);
-    if (!client)
+    context->client = avahi_client_new(context->poll_api, 0, avahi_client_callback, context, &error);
+    if (!context->client)
     {
         error_printf("Failed to create Avahi client: %s\n", avahi_strerror(error));
         goto fail;
     }
 
     /* Create the service browsers */
-    if (create_service_browser(client, "_lxi._tcp"))
+    if (create_service_browser(context, "_lxi._tcp"))
         goto fail_sb;
-    if (create_service_browser(client, "_vxi-11._tcp"))
+    if (create_service_browser(context, "_vxi-11._tcp"))
         goto fail_sb;
-    if (create_service_browser(client, "_scpi-raw._tcp"))
+    if (create_service_browser(context, "_scpi-raw._tcp"))
         goto fail_sb;
-    if (create_service_browser(client, "_scpi-telnet._tcp"))
+    if (create_service_browser(context, "_scpi-telnet._tcp"))
         goto fail_sb;
-    if (create_service_browser(client, "_hislip._tcp"))
+    if (create_service_browser(context, "_hislip._tcp"))
         goto fail_sb;
 
     // Set timeout
     avahi_elapse_time(&tv, timeout, 0);
-    poll_api->timeout_new(poll_api, &tv, avahi_terminate, NULL);
+    context->poll_api->timeout_new(context->poll_api, &tv, callback, context);
 
     /* Run the main Avahi loop */
-    avahi_simple_poll_loop(simple_poll);
+    avahi_simple_poll_loop(context->simple_poll);
 
-    status = 0;
+    status = context->status;
 
 fail_sb:
-    while (--count >= 0)
+    while (--context->count >= 0)
     {
-        avahi_service_browser_free(sb[count]);
+        avahi_service_browser_free(context->sb[context->count]);
     }
 fail:
-    if (client)
-        avahi_client_free(client);
-    if (simple_poll)
-        avahi_simple_poll_free(simple_poll);
+    // Also frees any resolvers still running
+    if (context->client)
+        avahi_client_free(context->client);
+    if (context->simple_poll)
+        avahi_simple_poll_free(context->simple_poll);
+    return status;
+}
+
+int avahi_discover(lxi_info_t *info, unsigned int interface, int timeout)
+{
+    avahi_context_t context;
+
+    memset(&context, 0, sizeof(context));
+    context.info = info;
+    context.interface = (interface != 0) ? (AvahiIfIndex) interface : AVAHI_IF_UNSPEC;
+    context.protocol = AVAHI_PROTO_INET;
+
+    return avahi_browse(&context, timeout, avahi_terminate);
+}
+
+int avahi_discover_txt(lxi_mdns_info_t *info, unsigned int interface, lxi_family_t family, int timeout)
+{
+    avahi_context_t context;
+
+    memset(&context, 0, sizeof(context));
+    context.mdns_info = info;
+    context.interface = (interface != 0) ? (AvahiIfIndex) interface : AVAHI_IF_UNSPEC;
+    context.protocol = avahi_protocol(family);
+
+    return avahi_browse(&context, timeout, avahi_terminate);
+}
+
+int avahi_watch(mdns_watch_t *watch, int interval)
+{
+    avahi_context_t context;
+    avahi_service_t *service;
+    int status;
+
+    memset(&context, 0, sizeof(context));
+    context.watch = watch;
+    context.interface = AVAHI_IF_UNSPEC;
+    context.protocol = AVAHI_PROTO_INET;
+    context.interval = interval;
+
+    // Browsers stay open and report services as they come and go
+    status = avahi_browse(&context, interval, avahi_check_cancelled);
+
+    while ((service = context.services) != NULL)
+    {
+        context.services = service->next;
+        service_free(service);
+    }
+
     return status;
 }
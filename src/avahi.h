@@ -33,6 +33,10 @@
 
 #include <lxi.h>
 
-int avahi_discover(lxi_info_t *info, int timeout);
+#include "mdns.h"
+
+int avahi_discover(lxi_info_t *info, unsigned int interface, int timeout);
+int avahi_discover_txt(lxi_mdns_info_t *info, unsigned int interface, lxi_family_t family, int timeout);
+int avahi_watch(mdns_watch_t *watch, int interval);
 
 #endif
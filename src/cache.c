@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2017-2022  Martin Lund
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "cache.h"
+#include "error.h"
+
+#define CACHE_MAGIC        0x4c584943 // "LXIC"
+#define CACHE_VERSION               2
+#define CACHE_ENTRIES_MAX         256
+#define CACHE_MISSED_MAX            3 // Forget devices absent this many discoveries in a row
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t reserved;
+    cache_entry_t entries[CACHE_ENTRIES_MAX];
+} cache_file_t;
+
+static char *cache_path = NULL;
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Map cache file, creating it if needed, with a lock held on return
+static cache_file_t *cache_map(int *fd, bool exclusive)
+{
+    cache_file_t *cache;
+    struct stat st;
+
+    pthread_mutex_lock(&cache_mutex);
+    if (cache_path == NULL)
+    {
+        pthread_mutex_unlock(&cache_mutex);
+        return NULL;
+    }
+    *fd = open(cache_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    pthread_mutex_unlock(&cache_mutex);
+
+    if (*fd < 0)
+    {
+        error_printf("Could not open discovery cache (%s)\n", strerror(errno));
+        return NULL;
+    }
+
+    // Serialize against other processes sharing the cache
+    if (flock(*fd, exclusive ? LOCK_EX : LOCK_SH) != 0)
+        goto error_lock;
+
+    if (fstat(*fd, &st) != 0)
+        goto error_lock;
+
+    // Size new or foreign files to hold a full cache, reset below if invalid
+    if ((st.st_size != sizeof(cache_file_t)) && (!exclusive || (ftruncate(*fd, sizeof(cache_file_t)) != 0)))
+        goto error_lock;
+
+    cache = mmap(NULL, sizeof(cache_file_t), exclusive ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, *fd, 0);
+    if (cache == MAP_FAILED)
+        goto error_lock;
+
+    return cache;
+
+error_lock:
+    close(*fd);
+    return NULL;
+}
+
+static void cache_unmap(cache_file_t *cache, int fd, bool modified)
+{
+    if (modified)
+        msync(cache, sizeof(cache_file_t), MS_ASYNC);
+    munmap(cache, sizeof(cache_file_t));
+
+    // Closing releases lock
+    close(fd);
+}
+
+static bool cache_valid(cache_file_t *cache)
+{
+    return (cache->magic == CACHE_MAGIC) && (cache->version == CACHE_VERSION) &&
+           (cache->count <= CACHE_ENTRIES_MAX);
+}
+
+int cache_set_path(const char *path)
+{
+    char *file = NULL;
+
+    if ((path != NULL) && ((file = strdup(path)) == NULL))
+        return -1;
+
+    pthread_mutex_lock(&cache_mutex);
+    free(cache_path);
+    cache_path = file;
+    pthread_mutex_unlock(&cache_mutex);
+
+    return 0;
+}
+
+// Returns copy of cached devices, to be freed by caller
+int cache_load(cache_entry_t **entries)
+{
+    cache_file_t *cache;
+    int count = 0;
+    int fd;
+
+    *entries = NULL;
+
+    cache = cache_map(&fd, false);
+    if (cache == NULL)
+        return 0;
+
+    if (cache_valid(cache) && (cache->count > 0))
+    {
+        *entries = malloc(cache->count * sizeof(cache_entry_t));
+        if (*entries != NULL)
+        {
+            count = cache->count;
+            memcpy(*entries, cache->entries, count * sizeof(cache_entry_t));
+        }
+    }
+
+    cache_unmap(cache, fd, false);
+
+    return count;
+}
+
+// Merge discovery outcome into cache, entries not in it are left untouched
+int cache_store(cache_entry_t *entries, int count)
+{
+    cache_file_t *cache;
+    cache_entry_t *entry;
+    int fd;
+    int i, j, k;
+
+    cache = cache_map(&fd, true);
+    if (cache == NULL)
+        return -1;
+
+    if (!cache_valid(cache))
+    {
+        memset(cache, 0, sizeof(cache_file_t));
+        cache->magic = CACHE_MAGIC;
+        cache->version = CACHE_VERSION;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        for (j = 0; j < (int) cache->count; j++)
+        {
+            if (cache->entries[j].address == entries[i].address)
+                break;
+        }
+
+        // Replace least recently seen device if full
+        if (j == CACHE_ENTRIES_MAX)
+        {
+            j = 0;
+            for (k = 1; k < CACHE_ENTRIES_MAX; k++)
+            {
+                if (cache->entries[k].last_seen < cache->entries[j].last_seen)
+                    j = k;
+            }
+        }
+        else if (j == (int) cache->count)
+            cache->count++;
+
+        entry = &cache->entries[j];
+        memcpy(entry, &entries[i], sizeof(cache_entry_t));
+        entry->id[CACHE_ID_LENGTH_MAX - 1] = 0;
+    }
+
+    // Forget devices which have been absent too long
+    for (j = 0; j < (int) cache->count; )
+    {
+        if (cache->entries[j].missed >= CACHE_MISSED_MAX)
+        {
+            cache->count--;
+            memmove(&cache->entries[j], &cache->entries[j + 1], (cache->count - j) * sizeof(cache_entry_t));
+        }
+        else
+            j++;
+    }
+
+    cache_unmap(cache, fd, true);
+
+    return 0;
+}
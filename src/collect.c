@@ -0,0 +1,387 @@
+/*
+ * Copyright (c) 2017-2022  Martin Lund
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <lxi.h>
+#include "collect.h"
+#include "vxi11.h"
+#include "mdns.h"
+#include "error.h"
+
+#define PORT_RPC 111
+#define ID_LENGTH_MAX 1024
+
+typedef struct
+{
+    char *name;
+    int port;
+} collect_service_t;
+
+typedef struct
+{
+    char *address;
+    char *id;
+    bool id_final;  // ID reported by device itself or its TXT record, preferred over mDNS names
+    collect_service_t *services;
+    int service_count;
+} collect_device_t;
+
+typedef struct
+{
+    pthread_mutex_t mutex;
+    collect_device_t *devices;
+    int count;
+    int timeout;
+} collector_t;
+
+// Collector of the discovery running in this thread, callbacks carry no context
+static __thread collector_t *collector_current = NULL;
+
+static collect_device_t *collect_device(collector_t *collector, const char *address)
+{
+    collect_device_t *devices;
+    collect_device_t *device;
+    int i;
+
+    for (i = 0; i < collector->count; i++)
+    {
+        if (strcmp(collector->devices[i].address, address) == 0)
+            return &collector->devices[i];
+    }
+
+    devices = realloc(collector->devices, (collector->count + 1) * sizeof(collect_device_t));
+    if (devices == NULL)
+        return NULL;
+    collector->devices = devices;
+
+    device = &collector->devices[collector->count];
+    memset(device, 0, sizeof(collect_device_t));
+    device->address = strdup(address);
+    if (device->address == NULL)
+        return NULL;
+    collector->count++;
+
+    return device;
+}
+
+static void collect_id(collect_device_t *device, const char *id, bool id_final)
+{
+    char *id_new;
+
+    if ((device->id != NULL) && (device->id_final || !id_final))
+        return;
+
+    id_new = strdup(id);
+    if (id_new == NULL)
+        return;
+
+    free(device->id);
+    device->id = id_new;
+    device->id_final = id_final;
+}
+
+static void collect_service(collect_device_t *device, const char *name, int port)
+{
+    collect_service_t *services;
+    int i;
+
+    for (i = 0; i < device->service_count; i++)
+    {
+        if ((strcmp(device->services[i].name, name) == 0) && (device->services[i].port == port))
+            return;
+    }
+
+    services = realloc(device->services, (device->service_count + 1) * sizeof(collect_service_t));
+    if (services == NULL)
+        return;
+    device->services = services;
+
+    services[device->service_count].name = strdup(name);
+    if (services[device->service_count].name == NULL)
+        return;
+    services[device->service_count].port = port;
+    device->service_count++;
+}
+
+static void collect_device_found(const char *address, const char *id)
+{
+    collector_t *collector = collector_current;
+    collect_device_t *device;
+
+    pthread_mutex_lock(&collector->mutex);
+    device = collect_device(collector, address);
+    if (device != NULL)
+    {
+        collect_id(device, id, true);
+        collect_service(device, "vxi-11", PORT_RPC);
+    }
+    pthread_mutex_unlock(&collector->mutex);
+}
+
+static void collect_service_found(const char *address, const char *id, const char *service, int port,
+        const lxi_txt_t *txt, int txt_count)
+{
+    collector_t *collector = collector_current;
+    collect_device_t *device;
+    char device_id[ID_LENGTH_MAX];
+
+    pthread_mutex_lock(&collector->mutex);
+    device = collect_device(collector, address);
+    if (device != NULL)
+    {
+        // Identification announced by device spares connecting to it
+        if (mdns_txt_id(txt, txt_count, device_id, sizeof(device_id)) == 0)
+            collect_id(device, device_id, true);
+        else
+            collect_id(device, id, false);
+        collect_service(device, service, port);
+    }
+    pthread_mutex_unlock(&collector->mutex);
+}
+
+static void *thread_collect_mdns(void *ptr)
+{
+    collector_t *collector = (collector_t *) ptr;
+    lxi_mdns_info_t info = { .service = collect_service_found };
+
+    collector_current = collector;
+    mdns_discover_txt(&info, NULL, FAMILY_IPV4, collector->timeout);
+    collector_current = NULL;
+
+    return NULL;
+}
+
+static int collect_compare(const void *a, const void *b)
+{
+    const collect_device_t *device_a = a, *device_b = b;
+    struct in_addr addr_a, addr_b;
+
+    // Numeric order for IPv4 addresses
+    if ((inet_pton(AF_INET, device_a->address, &addr_a) == 1) &&
+        (inet_pton(AF_INET, device_b->address, &addr_b) == 1) &&
+        (addr_a.s_addr != addr_b.s_addr))
+        return (ntohl(addr_a.s_addr) < ntohl(addr_b.s_addr)) ? -1 : 1;
+
+    return strcmp(device_a->address, device_b->address);
+}
+
+typedef struct
+{
+    char *pool;
+    size_t used;
+    const char **slots;  // Open addressing table of strings placed in pool
+    size_t mask;
+} intern_t;
+
+// FNV-1a
+static size_t intern_hash(const char *string)
+{
+    uint32_t hash = 2166136261u;
+
+    while (*string)
+        hash = (hash ^ (unsigned char) *string++) * 16777619u;
+
+    return hash;
+}
+
+static int intern_init(intern_t *intern, char *pool, size_t string_count)
+{
+    size_t size = 16;
+
+    // Kept at most half full so probe sequences stay short
+    while (size < 2 * string_count)
+        size *= 2;
+
+    intern->slots = calloc(size, sizeof(const char *));
+    if (intern->slots == NULL)
+        return -1;
+    intern->mask = size - 1;
+    intern->pool = pool;
+    intern->used = 0;
+
+    return 0;
+}
+
+// Place string in pool once, returns its copy
+static const char *intern(intern_t *intern, const char *string)
+{
+    size_t i = intern_hash(string) & intern->mask;
+    char *copy;
+
+    while (intern->slots[i] != NULL)
+    {
+        if (strcmp(intern->slots[i], string) == 0)
+            return intern->slots[i];
+        i = (i + 1) & intern->mask;
+    }
+
+    copy = intern->pool + intern->used;
+    strcpy(copy, string);
+    intern->used += strlen(string) + 1;
+    intern->slots[i] = copy;
+
+    return copy;
+}
+
+// Pack devices, their services and strings into one allocation owned by caller
+static lxi_device_t *collect_pack(collector_t *collector)
+{
+    lxi_device_service_t *services;
+    lxi_device_t *devices;
+    collect_device_t *device;
+    intern_t strings;
+    size_t service_total = 0;
+    size_t string_total = 0;
+    char *pool;
+    int i, j;
+
+    for (i = 0; i < collector->count; i++)
+    {
+        device = &collector->devices[i];
+        string_total += strlen(device->address) + 1 + strlen(device->id) + 1;
+        for (j = 0; j < device->service_count; j++)
+            string_total += strlen(device->services[j].name) + 1;
+        service_total += device->service_count;
+    }
+
+    devices = malloc(collector->count * sizeof(lxi_device_t) + service_total * sizeof(lxi_device_service_t) + string_total);
+    if (devices == NULL)
+        return NULL;
+
+    services = (lxi_device_service_t *) (devices + collector->count);
+    pool = (char *) (services + service_total);
+
+    if (intern_init(&strings, pool, 2 * collector->count + service_total) != 0)
+    {
+        free(devices);
+        return NULL;
+    }
+
+    for (i = 0; i < collector->count; i++)
+    {
+        device = &collector->devices[i];
+        devices[i].address = intern(&strings, device->address);
+        devices[i].id = intern(&strings, device->id);
+        devices[i].services = services;
+        devices[i].service_count = device->service_count;
+
+        for (j = 0; j < device->service_count; j++)
+        {
+            services->name = intern(&strings, device->services[j].name);
+            services->port = device->services[j].port;
+            services++;
+        }
+    }
+
+    free(strings.slots);
+
+    return devices;
+}
+
+static void collect_free(collector_t *collector)
+{
+    int i, j;
+
+    for (i = 0; i < collector->count; i++)
+    {
+        for (j = 0; j < collector->devices[i].service_count; j++)
+            free(collector->devices[i].services[j].name);
+        free(collector->devices[i].services);
+        free(collector->devices[i].address);
+        free(collector->devices[i].id);
+    }
+    free(collector->devices);
+    pthread_mutex_destroy(&collector->mutex);
+}
+
+int collect_devices(lxi_device_t **devices, int timeout, lxi_discover_t type)
+{
+    lxi_info_t info = { .broadcast = NULL, .device = collect_device_found, .service = NULL };
+    collector_t collector;
+    pthread_t thread;
+    bool mdns_thread = false;
+    int count;
+    int i;
+
+    memset(&collector, 0, sizeof(collector));
+    pthread_mutex_init(&collector.mutex, NULL);
+    collector.timeout = timeout;
+
+    // Search via mDNS alongside VXI-11 broadcast when looking for both
+    if ((type == DISCOVER_MDNS) || (type == DISCOVER_ALL))
+    {
+        if (pthread_create(&thread, NULL, thread_collect_mdns, &collector) == 0)
+            mdns_thread = true;
+        else
+            thread_collect_mdns(&collector);
+    }
+
+    if ((type == DISCOVER_VXI11) || (type == DISCOVER_ALL))
+    {
+        collector_current = &collector;
+        vxi11_discover(&info, timeout);
+        collector_current = NULL;
+    }
+
+    if (mdns_thread)
+        pthread_join(thread, NULL);
+
+    // Devices without any name are named by their address
+    for (i = 0; i < collector.count; i++)
+    {
+        if (collector.devices[i].id == NULL)
+            collect_id(&collector.devices[i], collector.devices[i].address, false);
+        if (collector.devices[i].id == NULL)
+            break;
+    }
+
+    *devices = NULL;
+    count = collector.count;
+
+    if (i < collector.count)
+        count = -1;
+    else if (count > 0)
+    {
+        qsort(collector.devices, collector.count, sizeof(collect_device_t), collect_compare);
+        *devices = collect_pack(&collector);
+        if (*devices == NULL)
+            count = -1;
+    }
+
+    collect_free(&collector);
+
+    return count;
+}
@@ -3,6 +3,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include "lxi.h"
+#include "mdns.h"
 #include <dlfcn.h>
 #include <winsock2.h>
 #include <ws2tcpip.h>
@@ -16,6 +17,16 @@
 typedef struct
 {
     lxi_info_t *info;
+    lxi_mdns_info_t *mdns_info;
+    uint32_t interface;
+    int family;
+} discover_data_t;
+
+typedef struct
+{
+    lxi_info_t *info;
+    lxi_mdns_info_t *mdns_info;
+    int family;
     char *servicename;
     char *regtype;
 } browse_data_t;
@@ -114,27 +125,60 @@ error_load:
    return -1;
 }
 
-void resolve_ip_address(const char *hostname, uint16_t port, char *ip_address)
+void resolve_ip_address(const char *hostname, uint16_t port, int family, char *ip_address, size_t size)
 {
     struct addrinfo hints, *servinfo, *p;
     char port_str[6];
+    char if_name[IF_NAMESIZE];
+    size_t length;
     sprintf(port_str, "%u", port);
 
     memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_INET;
+    hints.ai_family = family;
     hints.ai_socktype = SOCK_STREAM;
 
-    getaddrinfo(hostname, port_str, &hints, &servinfo);
+    if (getaddrinfo(hostname, port_str, &hints, &servinfo) != 0)
+        return;
     for (p = servinfo; p != NULL; p = p->ai_next)
     {
-        struct sockaddr_in *ipv4 = (struct sockaddr_in *)p->ai_addr;
-        inet_ntop(p->ai_family, &(ipv4->sin_addr), ip_address, INET_ADDRSTRLEN);
+        if (p->ai_family == AF_INET)
+        {
+            struct sockaddr_in *ipv4 = (struct sockaddr_in *)p->ai_addr;
+            inet_ntop(p->ai_family, &(ipv4->sin_addr), ip_address, size);
+        }
+        else if (p->ai_family == AF_INET6)
+        {
+            struct sockaddr_in6 *ipv6 = (struct sockaddr_in6 *)p->ai_addr;
+            inet_ntop(p->ai_family, &(ipv6->sin6_addr), ip_address, size);
+
+            // Link-local address is only usable along with its interface
+            if (IN6_IS_ADDR_LINKLOCAL(&ipv6->sin6_addr) && (if_indextoname(ipv6->sin6_scope_id, if_name) != NULL))
+            {
+                length = strlen(ip_address);
+                snprintf(ip_address + length, size - length, "%%%s", if_name);
+            }
+        }
+        else
+            continue;
         break;
     }
 
     freeaddrinfo(servinfo);
 }
 
+static int address_family(lxi_family_t family)
+{
+    switch (family)
+    {
+        case FAMILY_IPV6:
+            return AF_INET6;
+        case FAMILY_ANY:
+            return AF_UNSPEC;
+        default:
+            return AF_INET;
+    }
+}
+
 void resolve_callback(
     DNSServiceRef sdRef,
     DNSServiceFlags flags,
@@ -153,10 +197,11 @@ void resolve_callback(
         return;
     }
 
-    char ip_address[INET_ADDRSTRLEN];
-    resolve_ip_address(hosttarget, port, ip_address);
-
     browse_data_t *browse_data = (browse_data_t *)context;
+
+    char ip_address[INET6_ADDRSTRLEN + IF_NAMESIZE + 1] = "Unknown";
+    resolve_ip_address(hosttarget, port, browse_data->family, ip_address, sizeof(ip_address));
+
     lxi_info_t *info = (lxi_info_t *)browse_data->info;
 
     // Pretty print service type
@@ -170,7 +215,19 @@ void resolve_callback(
         }
     }
 
-    info->service(ip_address, browse_data->servicename, service_type, ntohs(port));
+    if (browse_data->mdns_info != NULL)
+    {
+        // Pass on TXT record as key/value pairs
+        mdns_txt_t txt = { NULL, 0 };
+
+        mdns_txt_parse(&txt, txtRecord, txtLen);
+        if (browse_data->mdns_info->service != NULL)
+            browse_data->mdns_info->service(ip_address, browse_data->servicename, service_type, ntohs(port),
+                    txt.items, txt.count);
+        mdns_txt_free(&txt);
+    }
+    else if (info->service != NULL)
+        info->service(ip_address, browse_data->servicename, service_type, ntohs(port));
 
     free(browse_data->regtype);
     free(browse_data->servicename);
@@ -196,8 +253,10 @@ void browse_callback(
     char if_name[IF_NAMESIZE];
     if_indextoname((unsigned int)interfaceIndex, if_name);
 
-    lxi_info_t *info = (lxi_info_t *)context;
-    info->broadcast(serviceName, if_name);
+    discover_data_t *discover_data = (discover_data_t *)context;
+    lxi_info_t *info = discover_data->info;
+    if ((info != NULL) && (info->broadcast != NULL))
+        info->broadcast(serviceName, if_name);
 
     browse_data_t *browse_data = (browse_data_t *)malloc(sizeof(browse_data_t));
     if (!browse_data)
@@ -207,6 +266,8 @@ void browse_callback(
     }
 
     browse_data->info = info;
+    browse_data->mdns_info = discover_data->mdns_info;
+    browse_data->family = discover_data->family;
     browse_data->servicename = strdup(serviceName);
     browse_data->regtype = strdup(regtype);
 
@@ -230,7 +291,7 @@ void browse_callback(
     DNSServiceRefDeallocate(resolveService);
 }
 
-void browse_lxi_services(lxi_info_t *info, int timeout_ms)
+void browse_lxi_services(discover_data_t *discover_data, int timeout_ms)
 {
     DNSServiceRef service;
     DNSServiceErrorType error;
@@ -238,7 +299,7 @@ void browse_lxi_services(lxi_info_t *info, int timeout_ms)
     const TIMEVAL timeout = {(timeout_ms / 1000), (timeout_ms % 1000) * 1000};
     for (lxi_service_t *s = lxi_services; s->broadcast_type != NULL; s++)
     {
-        error = DNSServiceBrowse(&service, 0, 0, s->broadcast_type, NULL, browse_callback, info);
+        error = DNSServiceBrowse(&service, 0, discover_data->interface, s->broadcast_type, NULL, browse_callback, discover_data);
         if (error != kDNSServiceErr_NoError)
         {
             fprintf(stderr, "DNSServiceBrowse() failed: %d\n", error);
@@ -279,14 +340,30 @@ void browse_lxi_services(lxi_info_t *info, int timeout_ms)
     DNSServiceRefDeallocate(service);
 }
 
-int cygwin_dnssd_discover(lxi_info_t *info, int timeout_ms)
+int cygwin_dnssd_discover(lxi_info_t *info, unsigned int interface, int timeout_ms)
+{
+    discover_data_t discover_data = { info, NULL, interface, AF_INET };
+
+    if(load_cygwin_dnssd_dll()!=0)
+    {
+        fprintf(stderr, "error load dll %s\n", DNSSD_DLL);
+        return -1;
+    }
+    browse_lxi_services(&discover_data, timeout_ms);
+
+    return 0;
+}
+
+int cygwin_dnssd_discover_txt(lxi_mdns_info_t *info, unsigned int interface, lxi_family_t family, int timeout_ms)
 {
+    discover_data_t discover_data = { NULL, info, interface, address_family(family) };
+
     if(load_cygwin_dnssd_dll()!=0)
     {
         fprintf(stderr, "error load dll %s\n", DNSSD_DLL);
         return -1;
     }
-    browse_lxi_services(info, timeout_ms);
+    browse_lxi_services(&discover_data, timeout_ms);
 
     return 0;
 }
@@ -3,6 +3,7 @@
 
 #include <lxi.h>
 
-int cygwin_dnssd_discover(lxi_info_t *info, int timeout);
+int cygwin_dnssd_discover(lxi_info_t *info, unsigned int interface, int timeout);
+int cygwin_dnssd_discover_txt(lxi_mdns_info_t *info, unsigned int interface, lxi_family_t family, int timeout);
 
 #endif // CYGWIN_DNSSD_H
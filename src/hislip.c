@@ -0,0 +1,1535 @@
+/*
+ * Copyright (c) 2026  Martin Lund
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#ifdef HAVE_OPENSSL
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+#endif
+#include "hislip.h"
+#include "session.h"
+#include "error.h"
+
+#define HISLIP_PORT                         4880
+#define HISLIP_SUB_ADDRESS                  "hislip0"
+#define HISLIP_PROTOCOL_VERSION             0x0100 // 1.0
+#define HISLIP_PROTOCOL_VERSION_TLS         0x0200 // 2.0, required for encryption
+#define HISLIP_VENDOR_ID                    0x4c58 // "LX"
+#define HISLIP_HEADER_SIZE                  16
+#define HISLIP_MESSAGE_ID_INITIAL           0xffffff00
+#define HISLIP_MAX_MESSAGE_SIZE             (1 << 20)
+#define HISLIP_ERROR_MESSAGE_MAX            256
+#define HISLIP_MESSAGE_TIMEOUT              5000
+#define HISLIP_TIMEOUT_MARGIN               500
+
+// HiSLIP message types
+#define HISLIP_INITIALIZE                   0
+#define HISLIP_INITIALIZE_RESPONSE          1
+#define HISLIP_FATAL_ERROR                  2
+#define HISLIP_ERROR                        3
+#define HISLIP_ASYNC_LOCK                   4
+#define HISLIP_ASYNC_LOCK_RESPONSE          5
+#define HISLIP_DATA                         6
+#define HISLIP_DATA_END                     7
+#define HISLIP_DEVICE_CLEAR_COMPLETE        8
+#define HISLIP_DEVICE_CLEAR_ACKNOWLEDGE     9
+#define HISLIP_ASYNC_REMOTE_LOCAL_CONTROL   10
+#define HISLIP_ASYNC_REMOTE_LOCAL_RESPONSE  11
+#define HISLIP_TRIGGER                      12
+#define HISLIP_INTERRUPTED                  13
+#define HISLIP_ASYNC_INTERRUPTED            14
+#define HISLIP_ASYNC_MAX_MESSAGE_SIZE       15
+#define HISLIP_ASYNC_MAX_MESSAGE_SIZE_RESP  16
+#define HISLIP_ASYNC_INITIALIZE             17
+#define HISLIP_ASYNC_INITIALIZE_RESPONSE    18
+#define HISLIP_ASYNC_DEVICE_CLEAR           19
+#define HISLIP_ASYNC_SERVICE_REQUEST        20
+#define HISLIP_ASYNC_STATUS_QUERY           21
+#define HISLIP_ASYNC_STATUS_RESPONSE        22
+#define HISLIP_ASYNC_DEVICE_CLEAR_ACK       23
+#define HISLIP_START_TLS                    28
+#define HISLIP_ASYNC_START_TLS              29
+#define HISLIP_ASYNC_START_TLS_RESPONSE     30
+
+// Control code bits
+#define HISLIP_CONTROL_OVERLAPPED           0x01
+#define HISLIP_CONTROL_ENCRYPTION_MANDATORY 0x02
+#define HISLIP_CONTROL_RMT_DELIVERED        0x01
+#define HISLIP_CONTROL_LOCK_RELEASE         0x00
+#define HISLIP_CONTROL_LOCK_REQUEST         0x01
+
+// Lock response codes
+#define HISLIP_LOCK_FAILURE                 0
+#define HISLIP_LOCK_SUCCESS                 1
+#define HISLIP_LOCK_SUCCESS_SHARED          2
+#define HISLIP_LOCK_ERROR                   3
+
+// StartTLS response codes
+#define HISLIP_START_TLS_SUCCESS            1
+
+// Remote/local control requests
+#define HISLIP_REMOTE_ENABLE_GO_REMOTE      3
+#define HISLIP_REMOTE_GO_LOCAL              6
+
+static long long time_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int wait_socket(int socket, short events, long long deadline)
+{
+    struct pollfd pfd;
+    long long remaining;
+    int status;
+
+    pfd.fd = socket;
+    pfd.events = events;
+
+    do
+    {
+        remaining = deadline - time_ms();
+        if (remaining < 0)
+            remaining = 0;
+        status = poll(&pfd, 1, (int) remaining);
+    } while ((status < 0) && (errno == EINTR));
+
+    if (status == 0)
+    {
+        error_printf("Timeout\n");
+        return -1;
+    }
+    else if (status < 0)
+    {
+        error_printf("%s\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+#ifdef HAVE_OPENSSL
+static char *tls_ca_file = NULL;
+static pthread_mutex_t tls_ca_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void tls_print_error(void)
+{
+    unsigned long error = ERR_get_error();
+
+    if (error != 0)
+        error_printf("TLS: %s\n", ERR_reason_error_string(error));
+    else
+        error_printf("TLS: %s\n", strerror(errno));
+
+    ERR_clear_error();
+}
+
+// OpenSSL writes using write() so keep a closed peer from raising SIGPIPE
+static bool sigpipe_block(sigset_t *old)
+{
+    sigset_t set, pending;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    sigpending(&pending);
+    pthread_sigmask(SIG_BLOCK, &set, old);
+
+    return sigismember(&pending, SIGPIPE);
+}
+
+static void sigpipe_restore(sigset_t *old, bool was_pending)
+{
+    struct timespec zero = { 0, 0 };
+    sigset_t set;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+
+    // Consume SIGPIPE raised while blocked
+    if (!was_pending)
+        sigtimedwait(&set, NULL, &zero);
+
+    pthread_sigmask(SIG_SETMASK, old, NULL);
+}
+
+// Wait for the socket condition OpenSSL asks for
+static int tls_wait(hislip_channel_t *channel, int error, long long deadline)
+{
+    switch (error)
+    {
+        case SSL_ERROR_WANT_READ:
+            return wait_socket(channel->tcp.server_socket, POLLIN, deadline);
+        case SSL_ERROR_WANT_WRITE:
+            return wait_socket(channel->tcp.server_socket, POLLOUT, deadline);
+        case SSL_ERROR_ZERO_RETURN:
+            error_printf("Connection closed by peer\n");
+            return -1;
+        default:
+            tls_print_error();
+            return -1;
+    }
+}
+
+static int tls_send_all(hislip_channel_t *channel, struct iovec *iov, int iovcnt, long long deadline)
+{
+    sigset_t sigset;
+    bool sigpipe;
+    size_t offset;
+    int i, n, error;
+    int status = 0;
+
+    sigpipe = sigpipe_block(&sigset);
+
+    for (i = 0; (i < iovcnt) && (status == 0); i++)
+    {
+        offset = 0;
+        while (offset < iov[i].iov_len)
+        {
+            // Channel may be read by another thread at the same time
+            pthread_mutex_lock(&channel->tls_mutex);
+            n = SSL_write(channel->tls, (char *) iov[i].iov_base + offset, (int) (iov[i].iov_len - offset));
+            error = (n > 0) ? SSL_ERROR_NONE : SSL_get_error(channel->tls, n);
+            pthread_mutex_unlock(&channel->tls_mutex);
+
+            if (n > 0)
+                offset += n;
+            else if (tls_wait(channel, error, deadline) != 0)
+            {
+                status = -1;
+                break;
+            }
+        }
+    }
+
+    sigpipe_restore(&sigset, sigpipe);
+
+    return status;
+}
+
+static int tls_receive_all(hislip_channel_t *channel, void *buffer, size_t length, long long deadline)
+{
+    size_t offset = 0;
+    size_t size;
+    int n, error;
+
+    while (offset < length)
+    {
+        size = length - offset;
+        if (size > INT_MAX)
+            size = INT_MAX;
+
+        pthread_mutex_lock(&channel->tls_mutex);
+        n = SSL_read(channel->tls, (char *) buffer + offset, (int) size);
+        error = (n > 0) ? SSL_ERROR_NONE : SSL_get_error(channel->tls, n);
+        pthread_mutex_unlock(&channel->tls_mutex);
+
+        if (n > 0)
+            offset += n;
+        else if (tls_wait(channel, error, deadline) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+#endif
+
+// Wait without time limit until a message starts arriving on channel
+static void channel_wait(hislip_channel_t *channel)
+{
+    struct pollfd pfd;
+
+    pfd.fd = channel->tcp.server_socket;
+    pfd.events = POLLIN;
+
+    for (;;)
+    {
+#ifdef HAVE_OPENSSL
+        if (channel->tls != NULL)
+        {
+            char byte;
+            int n, error;
+
+            // Peeking also consumes records without application data, e.g. session tickets
+            pthread_mutex_lock(&channel->tls_mutex);
+            n = SSL_peek(channel->tls, &byte, 1);
+            error = (n > 0) ? SSL_ERROR_NONE : SSL_get_error(channel->tls, n);
+            pthread_mutex_unlock(&channel->tls_mutex);
+
+            if ((n > 0) || (error != SSL_ERROR_WANT_READ))
+                return;
+        }
+#endif
+        while ((poll(&pfd, 1, -1) < 0) && (errno == EINTR))
+            ;
+
+        if (channel->tls == NULL)
+            return;
+    }
+}
+
+static int send_all(hislip_channel_t *channel, struct iovec *iov, int iovcnt, long long deadline)
+{
+    int socket = channel->tcp.server_socket;
+    struct msghdr msg;
+    ssize_t n;
+
+#ifdef HAVE_OPENSSL
+    // With kernel TLS offload plain socket writes are encrypted by the kernel
+    if ((channel->tls != NULL) && !channel->ktls_send)
+        return tls_send_all(channel, iov, iovcnt, deadline);
+#endif
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+
+    while (msg.msg_iovlen > 0)
+    {
+        if (wait_socket(socket, POLLOUT, deadline) != 0)
+            return -1;
+
+        n = sendmsg(socket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0)
+        {
+            if ((errno == EINTR) || (errno == EAGAIN) || (errno == EWOULDBLOCK))
+                continue;
+            error_printf("%s\n", strerror(errno));
+            return -1;
+        }
+
+        // Skip past what was sent (handles partial sends)
+        while ((msg.msg_iovlen > 0) && ((size_t) n >= msg.msg_iov->iov_len))
+        {
+            n -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0)
+        {
+            msg.msg_iov->iov_base = (char *) msg.msg_iov->iov_base + n;
+            msg.msg_iov->iov_len -= n;
+        }
+    }
+
+    return 0;
+}
+
+static int receive_all(hislip_channel_t *channel, void *buffer, size_t length, long long deadline)
+{
+    int socket = channel->tcp.server_socket;
+    size_t offset = 0;
+    ssize_t n;
+
+#ifdef HAVE_OPENSSL
+    // Records are always read via OpenSSL which uses kernel TLS offload when enabled
+    if (channel->tls != NULL)
+        return tls_receive_all(channel, buffer, length, deadline);
+#endif
+
+    while (offset < length)
+    {
+        if (wait_socket(socket, POLLIN, deadline) != 0)
+            return -1;
+
+        n = recv(socket, (char *) buffer + offset, length - offset, MSG_DONTWAIT);
+        if (n < 0)
+        {
+            if ((errno == EINTR) || (errno == EAGAIN) || (errno == EWOULDBLOCK))
+                continue;
+            error_printf("%s\n", strerror(errno));
+            return -1;
+        }
+        else if (n == 0)
+        {
+            error_printf("Connection closed by peer\n");
+            return -1;
+        }
+
+        offset += n;
+    }
+
+    return 0;
+}
+
+static int discard(hislip_channel_t *channel, uint64_t length, long long deadline)
+{
+    char buffer[4096];
+    size_t size;
+
+    while (length > 0)
+    {
+        size = (length > sizeof(buffer)) ? sizeof(buffer) : (size_t) length;
+        if (receive_all(channel, buffer, size, deadline) != 0)
+            return -1;
+        length -= size;
+    }
+
+    return 0;
+}
+
+static int send_message(hislip_channel_t *channel, uint8_t type, uint8_t control, uint32_t parameter,
+                        const void *payload, uint64_t length, long long deadline)
+{
+    uint8_t header[HISLIP_HEADER_SIZE];
+    struct iovec iov[2];
+    int i;
+
+    // Build message header (network byte order)
+    header[0] = 'H';
+    header[1] = 'S';
+    header[2] = type;
+    header[3] = control;
+    for (i = 0; i < 4; i++)
+        header[4 + i] = (parameter >> (24 - 8 * i)) & 0xff;
+    for (i = 0; i < 8; i++)
+        header[8 + i] = (length >> (56 - 8 * i)) & 0xff;
+
+    iov[0].iov_base = header;
+    iov[0].iov_len = HISLIP_HEADER_SIZE;
+    iov[1].iov_base = (void *) payload;
+    iov[1].iov_len = length;
+
+    // Send header and payload in one go
+    return send_all(channel, iov, (length > 0) ? 2 : 1, deadline);
+}
+
+static int receive_header(hislip_channel_t *channel, hislip_header_t *header, long long deadline)
+{
+    uint8_t buffer[HISLIP_HEADER_SIZE];
+    int i;
+
+    if (receive_all(channel, buffer, HISLIP_HEADER_SIZE, deadline) != 0)
+        return -1;
+
+    if ((buffer[0] != 'H') || (buffer[1] != 'S'))
+    {
+        error_printf("Invalid HiSLIP message prologue\n");
+        return -1;
+    }
+
+    header->type = buffer[2];
+    header->control = buffer[3];
+    header->parameter = 0;
+    for (i = 0; i < 4; i++)
+        header->parameter = (header->parameter << 8) | buffer[4 + i];
+    header->length = 0;
+    for (i = 0; i < 8; i++)
+        header->length = (header->length << 8) | buffer[8 + i];
+
+    return 0;
+}
+
+static void print_error(hislip_channel_t *channel, hislip_header_t *header, long long deadline)
+{
+    char message[HISLIP_ERROR_MESSAGE_MAX];
+    size_t size;
+
+    size = (header->length < sizeof(message)) ? (size_t) header->length : sizeof(message) - 1;
+
+    if (receive_all(channel, message, size, deadline) != 0)
+        return;
+    message[size] = 0;
+    discard(channel, header->length - size, deadline);
+
+    error_printf("HiSLIP %s (code %d): %s\n",
+                 (header->type == HISLIP_FATAL_ERROR) ? "fatal error" : "error",
+                 header->control, message);
+}
+
+static int receive_response(hislip_channel_t *channel, uint8_t type, hislip_header_t *header,
+                            void *payload, size_t size, long long deadline)
+{
+    for (;;)
+    {
+        if (receive_header(channel, header, deadline) != 0)
+            return -1;
+
+        if (header->type == type)
+            break;
+
+        switch (header->type)
+        {
+            case HISLIP_FATAL_ERROR:
+            case HISLIP_ERROR:
+                print_error(channel, header, deadline);
+                return -1;
+            default:
+                // Skip unrelated messages (e.g. service requests)
+                if (discard(channel, header->length, deadline) != 0)
+                    return -1;
+                break;
+        }
+    }
+
+    if (header->length < size)
+        size = (size_t) header->length;
+
+    if (receive_all(channel, payload, size, deadline) != 0)
+        return -1;
+
+    return discard(channel, header->length - size, deadline);
+}
+
+static int async_exchange(hislip_channel_t *channel, uint8_t type, uint32_t parameter, const void *payload,
+                          uint64_t length, uint8_t response_type, hislip_header_t *response,
+                          void *response_payload, size_t response_size, long long deadline)
+{
+    if (send_message(channel, type, 0, parameter, payload, length, deadline) != 0)
+        return -1;
+
+    return receive_response(channel, response_type, response, response_payload, response_size, deadline);
+}
+
+static void deadline_to_timespec(long long deadline, struct timespec *ts)
+{
+    ts->tv_sec = deadline / 1000;
+    ts->tv_nsec = (deadline % 1000) * 1000000;
+}
+
+// Control code reporting a delivered response, taken by exactly one message
+// as status queries may race with the synchronous channel
+static uint8_t rmt_control(hislip_data_t *hislip_data)
+{
+    return atomic_exchange(&hislip_data->rmt_delivered, false) ? HISLIP_CONTROL_RMT_DELIVERED : 0;
+}
+
+static int async_transaction(hislip_data_t *hislip_data, uint8_t type, uint8_t control,
+                             uint32_t parameter, const void *payload, uint64_t length,
+                             uint8_t response_type, hislip_header_t *response,
+                             void *response_payload, size_t response_size, long long deadline)
+{
+    struct timespec ts;
+    int status = -1;
+
+    // One transaction at a time, independent of the synchronous channel
+    pthread_mutex_lock(&hislip_data->async_mutex);
+
+    pthread_mutex_lock(&hislip_data->response_mutex);
+    hislip_data->response_ready = false;
+    pthread_mutex_unlock(&hislip_data->response_mutex);
+
+    if (send_message(&hislip_data->async, type, control, parameter,
+                     payload, length, deadline) != 0)
+        goto out;
+
+    // Wait for asynchronous channel reader to deliver the response
+    deadline_to_timespec(deadline, &ts);
+    pthread_mutex_lock(&hislip_data->response_mutex);
+    for (;;)
+    {
+        // Skip late responses to earlier transactions which timed out
+        if (hislip_data->response_ready && (hislip_data->response.type != response_type) &&
+            (hislip_data->response.type != HISLIP_ERROR) &&
+            (hislip_data->response.type != HISLIP_FATAL_ERROR))
+            hislip_data->response_ready = false;
+
+        if (hislip_data->response_ready || hislip_data->async_closed)
+            break;
+
+        if (pthread_cond_timedwait(&hislip_data->response_cond, &hislip_data->response_mutex, &ts) == ETIMEDOUT)
+            break;
+    }
+
+    if (!hislip_data->response_ready)
+    {
+        if (hislip_data->async_closed)
+            error_printf("Connection closed by peer\n");
+        else
+            error_printf("Timeout\n");
+    }
+    else if ((hislip_data->response.type == HISLIP_ERROR) ||
+             (hislip_data->response.type == HISLIP_FATAL_ERROR))
+    {
+        hislip_data->response_payload[hislip_data->response_length] = 0;
+        error_printf("HiSLIP %s (code %d): %s\n",
+                     (hislip_data->response.type == HISLIP_FATAL_ERROR) ? "fatal error" : "error",
+                     hislip_data->response.control, hislip_data->response_payload);
+    }
+    else
+    {
+        *response = hislip_data->response;
+        if (response_size > hislip_data->response_length)
+            response_size = hislip_data->response_length;
+        if (response_size > 0)
+            memcpy(response_payload, hislip_data->response_payload, response_size);
+        status = 0;
+    }
+
+    hislip_data->response_ready = false;
+    pthread_mutex_unlock(&hislip_data->response_mutex);
+
+out:
+    pthread_mutex_unlock(&hislip_data->async_mutex);
+    return status;
+}
+
+static void *thread_async_reader(void *arg)
+{
+    hislip_data_t *hislip_data = (hislip_data_t *) arg;
+    hislip_channel_t *channel = &hislip_data->async;
+    hislip_header_t header;
+    long long deadline;
+    size_t size;
+    bool closing;
+
+    for (;;)
+    {
+        // Wait for next message
+        channel_wait(channel);
+
+        pthread_mutex_lock(&hislip_data->response_mutex);
+        closing = hislip_data->async_closing;
+        pthread_mutex_unlock(&hislip_data->response_mutex);
+        if (closing)
+            break;
+
+        // Rest of message is expected to follow promptly
+        deadline = time_ms() + HISLIP_MESSAGE_TIMEOUT;
+        if (receive_header(channel, &header, deadline) != 0)
+            break;
+
+        if (header.type == HISLIP_ASYNC_SERVICE_REQUEST)
+        {
+            if (discard(channel, header.length, deadline) != 0)
+                break;
+
+            // Hand over to service request thread so handler may use the session
+            pthread_mutex_lock(&hislip_data->response_mutex);
+            if (hislip_data->srq_enabled)
+            {
+                hislip_data->srq_pending++;
+                pthread_cond_signal(&hislip_data->srq_cond);
+            }
+            pthread_mutex_unlock(&hislip_data->response_mutex);
+            continue;
+        }
+
+        // Keep room for string termination of error messages
+        size = sizeof(hislip_data->response_payload) - 1;
+        if (header.length < size)
+            size = (size_t) header.length;
+
+        pthread_mutex_lock(&hislip_data->response_mutex);
+        if ((receive_all(channel, hislip_data->response_payload, size, deadline) != 0) ||
+            (discard(channel, header.length - size, deadline) != 0))
+        {
+            pthread_mutex_unlock(&hislip_data->response_mutex);
+            break;
+        }
+        hislip_data->response = header;
+        hislip_data->response_length = size;
+        hislip_data->response_ready = true;
+        pthread_cond_broadcast(&hislip_data->response_cond);
+        pthread_mutex_unlock(&hislip_data->response_mutex);
+    }
+
+    pthread_mutex_lock(&hislip_data->response_mutex);
+    hislip_data->async_closed = true;
+    pthread_cond_broadcast(&hislip_data->response_cond);
+    pthread_cond_broadcast(&hislip_data->srq_cond);
+    pthread_mutex_unlock(&hislip_data->response_mutex);
+
+    return NULL;
+}
+
+static void *thread_srq(void *arg)
+{
+    hislip_data_t *hislip_data = (hislip_data_t *) arg;
+    void (*handler)(int handle);
+    int handle;
+
+    pthread_mutex_lock(&hislip_data->response_mutex);
+
+    for (;;)
+    {
+        while ((hislip_data->srq_pending == 0) && !hislip_data->async_closed)
+            pthread_cond_wait(&hislip_data->srq_cond, &hislip_data->response_mutex);
+
+        if (hislip_data->async_closed)
+            break;
+
+        hislip_data->srq_pending--;
+        handler = hislip_data->srq_handler;
+        handle = hislip_data->srq_handle;
+
+        // Notify service request
+        pthread_mutex_unlock(&hislip_data->response_mutex);
+        if (handler != NULL)
+            handler(handle);
+        pthread_mutex_lock(&hislip_data->response_mutex);
+    }
+
+    pthread_mutex_unlock(&hislip_data->response_mutex);
+
+    return NULL;
+}
+
+static hislip_response_t *pending_find(hislip_data_t *hislip_data, uint32_t message_id)
+{
+    hislip_response_t *response;
+
+    for (response = hislip_data->pending; response != NULL; response = response->next)
+    {
+        if (response->message_id == message_id)
+            return response;
+    }
+
+    return NULL;
+}
+
+// Complete response to message ID or, if any is set, first complete response
+static hislip_response_t *pending_ready(hislip_data_t *hislip_data, bool any, uint32_t message_id)
+{
+    hislip_response_t *response;
+
+    for (response = hislip_data->pending; response != NULL; response = response->next)
+    {
+        if (response->complete && (any || (response->message_id == message_id)))
+            return response;
+    }
+
+    return NULL;
+}
+
+static hislip_response_t *pending_add(hislip_data_t *hislip_data, uint32_t message_id)
+{
+    hislip_response_t **tail = &hislip_data->pending;
+
+    // Keep responses in order of arrival
+    while (*tail != NULL)
+        tail = &(*tail)->next;
+
+    *tail = calloc(1, sizeof(hislip_response_t));
+    if (*tail == NULL)
+    {
+        error_printf("%s\n", strerror(errno));
+        return NULL;
+    }
+
+    (*tail)->message_id = message_id;
+
+    return *tail;
+}
+
+static void pending_remove(hislip_data_t *hislip_data, hislip_response_t *response)
+{
+    hislip_response_t **entry = &hislip_data->pending;
+
+    while (*entry != response)
+        entry = &(*entry)->next;
+
+    *entry = response->next;
+    free(response->data);
+    free(response);
+}
+
+static void pending_flush(hislip_data_t *hislip_data)
+{
+    while (hislip_data->pending != NULL)
+        pending_remove(hislip_data, hislip_data->pending);
+}
+
+static int pending_copy(hislip_data_t *hislip_data, hislip_response_t *response, char *message, int length)
+{
+    int status = (int) response->length;
+
+    if (response->length > (size_t) length)
+    {
+        error_printf("Message buffer too small\n");
+        status = -1;
+    }
+    else
+        memcpy(message, response->data, response->length);
+
+    pending_remove(hislip_data, response);
+    atomic_store(&hislip_data->rmt_delivered, true);
+
+    return status;
+}
+
+static int pending_append(hislip_data_t *hislip_data, hislip_header_t *header, long long deadline)
+{
+    hislip_channel_t *channel = &hislip_data->sync;
+    hislip_response_t *response;
+    char *data;
+
+    response = pending_find(hislip_data, header->parameter);
+    if (response == NULL)
+        response = pending_add(hislip_data, header->parameter);
+    if (response == NULL)
+        return -1;
+
+    // Device must keep to the message size we advertised, and responses must fit the returned length
+    if ((header->length > HISLIP_MAX_MESSAGE_SIZE - HISLIP_HEADER_SIZE) ||
+        (header->length > (uint64_t) INT_MAX - response->length))
+    {
+        error_printf("HiSLIP protocol error (response too large)\n");
+        pending_remove(hislip_data, response);
+        return -1;
+    }
+
+    data = realloc(response->data, response->length + header->length);
+    if ((data == NULL) && (response->length + header->length > 0))
+    {
+        error_printf("%s\n", strerror(errno));
+        return -1;
+    }
+    response->data = data;
+
+    if (receive_all(channel, response->data + response->length, header->length, deadline) != 0)
+        return -1;
+
+    response->length += header->length;
+    if (header->type == HISLIP_DATA_END)
+        response->complete = true;
+
+    return 0;
+}
+
+static void init_channel(hislip_channel_t *channel)
+{
+    channel->tcp.server_socket = -1;
+    channel->tls = NULL;
+    channel->ktls_send = false;
+    pthread_mutex_init(&channel->tls_mutex, NULL);
+}
+
+static int open_channel(hislip_channel_t *channel, const char *address, int port, long long deadline)
+{
+    long long remaining = deadline - time_ms();
+    int opt = 1;
+
+    if (tcp_connect(&channel->tcp, address, port, NULL, (remaining > 0) ? (int) remaining : 0) != 0)
+    {
+        channel->tcp.server_socket = -1;
+        return -1;
+    }
+
+    // Messages are small and latency bound so disable Nagle
+    setsockopt(channel->tcp.server_socket, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+    return 0;
+}
+
+static void close_channel(hislip_channel_t *channel)
+{
+#ifdef HAVE_OPENSSL
+    if (channel->tls != NULL)
+    {
+        sigset_t sigset;
+        bool sigpipe;
+
+        // Best effort close notify, socket is non-blocking
+        sigpipe = sigpipe_block(&sigset);
+        SSL_shutdown(channel->tls);
+        sigpipe_restore(&sigset, sigpipe);
+        SSL_free(channel->tls);
+        channel->tls = NULL;
+    }
+#endif
+
+    if (channel->tcp.server_socket >= 0)
+        close(channel->tcp.server_socket);
+
+    pthread_mutex_destroy(&channel->tls_mutex);
+}
+
+#ifdef HAVE_OPENSSL
+static SSL_CTX *tls_context(void)
+{
+    SSL_CTX *ctx;
+    int status;
+
+    ctx = SSL_CTX_new(TLS_client_method());
+    if (ctx == NULL)
+    {
+        tls_print_error();
+        return NULL;
+    }
+
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+#ifdef SSL_OP_ENABLE_KTLS
+    // Hand record layer over to kernel TLS when available
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#endif
+
+    pthread_mutex_lock(&tls_ca_mutex);
+    if (tls_ca_file != NULL)
+        status = SSL_CTX_load_verify_locations(ctx, tls_ca_file, NULL);
+    else
+        status = SSL_CTX_set_default_verify_paths(ctx);
+    pthread_mutex_unlock(&tls_ca_mutex);
+
+    if (status != 1)
+    {
+        tls_print_error();
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+static int tls_handshake(hislip_channel_t *channel, SSL_CTX *ctx, const char *address, long long deadline)
+{
+    int socket = channel->tcp.server_socket;
+    struct in_addr addr;
+    SSL *ssl;
+    int n, error, flags;
+
+    // OpenSSL must not block in order to honour deadline
+    flags = fcntl(socket, F_GETFL, 0);
+    if ((flags < 0) || (fcntl(socket, F_SETFL, flags | O_NONBLOCK) < 0))
+    {
+        error_printf("%s\n", strerror(errno));
+        return -1;
+    }
+
+    ssl = SSL_new(ctx);
+    if ((ssl == NULL) || (SSL_set_fd(ssl, socket) != 1))
+    {
+        tls_print_error();
+        SSL_free(ssl);
+        return -1;
+    }
+
+    // Verify certificate against address connected to
+    if (inet_pton(AF_INET, address, &addr) == 1)
+        X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), address);
+    else
+    {
+        SSL_set_tlsext_host_name(ssl, address);
+        SSL_set1_host(ssl, address);
+    }
+
+    for (;;)
+    {
+        n = SSL_connect(ssl);
+        if (n == 1)
+            break;
+
+        error = SSL_get_error(ssl, n);
+        if (tls_wait(channel, error, deadline) != 0)
+        {
+            if (SSL_get_verify_result(ssl) != X509_V_OK)
+                error_printf("TLS: %s\n", X509_verify_cert_error_string(SSL_get_verify_result(ssl)));
+            SSL_free(ssl);
+            return -1;
+        }
+    }
+
+    channel->tls = ssl;
+#ifdef BIO_get_ktls_send
+    channel->ktls_send = BIO_get_ktls_send(SSL_get_wbio(ssl));
+#endif
+
+    return 0;
+}
+
+static int start_tls(hislip_data_t *hislip_data, const char *address, long long deadline)
+{
+    hislip_header_t header;
+    SSL_CTX *ctx;
+    int status = -1;
+
+    if (hislip_data->server_version < HISLIP_PROTOCOL_VERSION_TLS)
+    {
+        error_printf("Server does not support encryption\n");
+        return -1;
+    }
+
+    ctx = tls_context();
+    if (ctx == NULL)
+        return -1;
+
+    // Encrypt asynchronous channel
+    if (async_exchange(&hislip_data->async, HISLIP_ASYNC_START_TLS, hislip_data->message_id,
+                       NULL, 0, HISLIP_ASYNC_START_TLS_RESPONSE, &header, NULL, 0, deadline) != 0)
+        goto out;
+
+    if (header.control != HISLIP_START_TLS_SUCCESS)
+    {
+        error_printf("Server refused to start TLS\n");
+        goto out;
+    }
+
+    if (tls_handshake(&hislip_data->async, ctx, address, deadline) != 0)
+        goto out;
+
+    // Encrypt synchronous channel
+    if (send_message(&hislip_data->sync, HISLIP_START_TLS, 0, hislip_data->message_id,
+                     NULL, 0, deadline) != 0)
+        goto out;
+
+    if (tls_handshake(&hislip_data->sync, ctx, address, deadline) != 0)
+        goto out;
+
+    status = 0;
+
+out:
+    SSL_CTX_free(ctx);
+    return status;
+}
+#endif
+
+static int connect_session(hislip_data_t *hislip_data, const char *address, int port,
+                           const char *name, int timeout, bool encrypted)
+{
+    long long deadline = time_ms() + timeout;
+    hislip_header_t header;
+    uint8_t size[8];
+    uint64_t max_message_size = HISLIP_MAX_MESSAGE_SIZE;
+    pthread_condattr_t condattr;
+    uint16_t version;
+    int i;
+
+    if (port == 0)
+        port = HISLIP_PORT;
+
+    if (name == NULL)
+        name = HISLIP_SUB_ADDRESS;
+
+    init_channel(&hislip_data->sync);
+    init_channel(&hislip_data->async);
+    hislip_data->message_id = HISLIP_MESSAGE_ID_INITIAL;
+    atomic_init(&hislip_data->last_message_id, HISLIP_MESSAGE_ID_INITIAL - 2);
+    hislip_data->max_message_size = HISLIP_MAX_MESSAGE_SIZE;
+    atomic_init(&hislip_data->rmt_delivered, false);
+    hislip_data->overlapped = false;
+    hislip_data->encrypted = encrypted;
+    hislip_data->pending = NULL;
+    hislip_data->timeout = timeout;
+    hislip_data->response_ready = false;
+    hislip_data->async_closing = false;
+    hislip_data->async_closed = false;
+    hislip_data->srq_enabled = false;
+    hislip_data->srq_pending = 0;
+
+    // Open synchronous channel
+    if (open_channel(&hislip_data->sync, address, port, deadline) != 0)
+        goto error;
+
+    version = encrypted ? HISLIP_PROTOCOL_VERSION_TLS : HISLIP_PROTOCOL_VERSION;
+    if (send_message(&hislip_data->sync, HISLIP_INITIALIZE, 0,
+                     (version << 16) | HISLIP_VENDOR_ID,
+                     name, strlen(name), deadline) != 0)
+        goto error;
+
+    if (receive_response(&hislip_data->sync, HISLIP_INITIALIZE_RESPONSE,
+                         &header, NULL, 0, deadline) != 0)
+        goto error;
+
+    hislip_data->server_version = header.parameter >> 16;
+    hislip_data->session_id = header.parameter & 0xffff;
+    hislip_data->overlapped = header.control & HISLIP_CONTROL_OVERLAPPED;
+
+    if (!encrypted && (header.control & HISLIP_CONTROL_ENCRYPTION_MANDATORY))
+    {
+        error_printf("Server requires encryption\n");
+        goto error;
+    }
+
+    // Open asynchronous channel
+    if (open_channel(&hislip_data->async, address, port, deadline) != 0)
+        goto error;
+
+    if (async_exchange(&hislip_data->async, HISLIP_ASYNC_INITIALIZE,
+                       hislip_data->session_id, NULL, 0, HISLIP_ASYNC_INITIALIZE_RESPONSE,
+                       &header, NULL, 0, deadline) != 0)
+        goto error;
+
+    // Negotiate maximum message size
+    for (i = 0; i < 8; i++)
+        size[i] = (max_message_size >> (56 - 8 * i)) & 0xff;
+
+    if (async_exchange(&hislip_data->async, HISLIP_ASYNC_MAX_MESSAGE_SIZE, 0,
+                       size, sizeof(size), HISLIP_ASYNC_MAX_MESSAGE_SIZE_RESP, &header,
+                       size, sizeof(size), deadline) != 0)
+        goto error;
+
+    if (header.length == sizeof(size))
+    {
+        max_message_size = 0;
+        for (i = 0; i < 8; i++)
+            max_message_size = (max_message_size << 8) | size[i];
+        if (max_message_size > HISLIP_HEADER_SIZE)
+            hislip_data->max_message_size = max_message_size;
+    }
+
+#ifdef HAVE_OPENSSL
+    if (encrypted && (start_tls(hislip_data, address, deadline) != 0))
+        goto error;
+#endif
+
+    // Start reader of asynchronous channel
+    pthread_condattr_init(&condattr);
+    pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&hislip_data->response_cond, &condattr);
+    pthread_cond_init(&hislip_data->srq_cond, NULL);
+    pthread_condattr_destroy(&condattr);
+    pthread_mutex_init(&hislip_data->async_mutex, NULL);
+    pthread_mutex_init(&hislip_data->response_mutex, NULL);
+
+    if (pthread_create(&hislip_data->async_thread, NULL, thread_async_reader, hislip_data) != 0)
+    {
+        error_printf("Failed to create thread\n");
+        goto error_thread;
+    }
+
+    return 0;
+
+error_thread:
+    pthread_mutex_destroy(&hislip_data->response_mutex);
+    pthread_mutex_destroy(&hislip_data->async_mutex);
+    pthread_cond_destroy(&hislip_data->srq_cond);
+    pthread_cond_destroy(&hislip_data->response_cond);
+error:
+    close_channel(&hislip_data->async);
+    close_channel(&hislip_data->sync);
+    return -1;
+}
+
+int hislip_connect(void *data, const char *address, int port, const char *name, int timeout)
+{
+    return connect_session((hislip_data_t *) data, address, port, name, timeout, false);
+}
+
+int hislip_tls_connect(void *data, const char *address, int port, const char *name, int timeout)
+{
+#ifdef HAVE_OPENSSL
+    return connect_session((hislip_data_t *) data, address, port, name, timeout, true);
+#else
+    error_printf("TLS support not available\n");
+    return -1;
+#endif
+}
+
+int hislip_set_tls_ca(const char *ca_file)
+{
+#ifdef HAVE_OPENSSL
+    char *file = NULL;
+
+    if ((ca_file != NULL) && ((file = strdup(ca_file)) == NULL))
+        return -1;
+
+    pthread_mutex_lock(&tls_ca_mutex);
+    free(tls_ca_file);
+    tls_ca_file = file;
+    pthread_mutex_unlock(&tls_ca_mutex);
+
+    return 0;
+#else
+    error_printf("TLS support not available\n");
+    return -1;
+#endif
+}
+
+int hislip_disconnect(void *data)
+{
+    hislip_data_t *hislip_data = (hislip_data_t *) data;
+
+    // Stop reader and service request threads
+    pthread_mutex_lock(&hislip_data->response_mutex);
+    hislip_data->async_closing = true;
+    pthread_mutex_unlock(&hislip_data->response_mutex);
+    shutdown(hislip_data->async.tcp.server_socket, SHUT_RDWR);
+    pthread_join(hislip_data->async_thread, NULL);
+    if (hislip_data->srq_enabled)
+        pthread_join(hislip_data->srq_thread, NULL);
+
+    close_channel(&hislip_data->async);
+    close_channel(&hislip_data->sync);
+    pthread_mutex_destroy(&hislip_data->response_mutex);
+    pthread_mutex_destroy(&hislip_data->async_mutex);
+    pthread_cond_destroy(&hislip_data->srq_cond);
+    pthread_cond_destroy(&hislip_data->response_cond);
+    pending_flush(hislip_data);
+
+    return 0;
+}
+
+int hislip_send(void *data, const char *message, int length, int timeout)
+{
+    hislip_data_t *hislip_data = (hislip_data_t *) data;
+    long long deadline = time_ms() + timeout;
+    uint64_t chunk = hislip_data->max_message_size - HISLIP_HEADER_SIZE;
+    uint64_t size;
+    uint8_t type;
+    int offset = 0;
+
+    // Split message into Data messages terminated by a DataEND message
+    do
+    {
+        size = length - offset;
+        if (size > chunk)
+            size = chunk;
+        type = ((offset + size) == (uint64_t) length) ? HISLIP_DATA_END : HISLIP_DATA;
+
+        if (send_message(&hislip_data->sync, type, rmt_control(hislip_data),
+                         hislip_data->message_id, message + offset, size, deadline) != 0)
+            return -1;
+
+        atomic_store(&hislip_data->last_message_id, hislip_data->message_id);
+        hislip_data->message_id += 2;
+        offset += size;
+    } while (offset < length);
+
+    return length;
+}
+
+// Receive response to message ID or, if any is set, the first response available
+static int receive_message(hislip_data_t *hislip_data, bool any, uint32_t message_id,
+                           char *message, int length, long long deadline)
+{
+    hislip_channel_t *channel = &hislip_data->sync;
+    hislip_response_t *response;
+    hislip_header_t header;
+    uint64_t size;
+    bool overflow = false;
+    int offset = 0;
+
+    // Check for response already received
+    response = pending_ready(hislip_data, any, message_id);
+    if (response != NULL)
+        return pending_copy(hislip_data, response, message, length);
+
+    for (;;)
+    {
+        if (receive_header(channel, &header, deadline) != 0)
+            return -1;
+
+        switch (header.type)
+        {
+            case HISLIP_DATA:
+            case HISLIP_DATA_END:
+                // First response to arrive is the one to receive
+                if (any && (pending_find(hislip_data, header.parameter) == NULL))
+                {
+                    message_id = header.parameter;
+                    any = false;
+                }
+
+                if ((header.parameter != message_id) || (pending_find(hislip_data, message_id) != NULL))
+                {
+                    // Discard stale responses in synchronized mode
+                    if (!hislip_data->overlapped)
+                    {
+                        if (discard(channel, header.length, deadline) != 0)
+                            return -1;
+                        break;
+                    }
+
+                    // Keep responses to other queries in flight
+                    if (pending_append(hislip_data, &header, deadline) != 0)
+                        return -1;
+
+                    // May complete a response partly received earlier
+                    response = pending_ready(hislip_data, any, message_id);
+                    if (response != NULL)
+                        return pending_copy(hislip_data, response, message, length);
+                    break;
+                }
+
+                // Receive payload directly into message buffer
+                size = length - offset;
+                if (header.length > size)
+                    overflow = true;
+                else
+                    size = header.length;
+
+                if (receive_all(channel, message + offset, size, deadline) != 0)
+                    return -1;
+                if (discard(channel, header.length - size, deadline) != 0)
+                    return -1;
+                offset += size;
+
+                if (header.type == HISLIP_DATA_END)
+                {
+                    atomic_store(&hislip_data->rmt_delivered, true);
+                    if (overflow)
+                    {
+                        error_printf("Message buffer too small\n");
+                        return -1;
+                    }
+                    return offset;
+                }
+                break;
+
+            case HISLIP_FATAL_ERROR:
+            case HISLIP_ERROR:
+                print_error(channel, &header, deadline);
+                return -1;
+
+            default:
+                // Skip e.g. Interrupted messages
+                if (discard(channel, header.length, deadline) != 0)
+                    return -1;
+                break;
+        }
+    }
+}
+
+int hislip_receive(void *data, char *message, int length, int timeout)
+{
+    hislip_data_t *hislip_data = (hislip_data_t *) data;
+    long long deadline = time_ms() + timeout;
+
+    // In overlapped mode responses are received in order of arrival
+    if (hislip_data->overlapped)
+        return receive_message(hislip_data, true, 0, message, length, deadline);
+
+    return receive_message(hislip_data, false, atomic_load(&hislip_data->last_message_id), message, length, deadline);
+}
+
+int hislip_send_query(void *data, const char *message, int length, unsigned int *id, int timeout)
+{
+    hislip_data_t *hislip_data = (hislip_data_t *) data;
+    int status;
+
+    status = hislip_send(data, message, length, timeout);
+    if (status < 0)
+        return status;
+
+    // Response is identified by the ID of the DataEND message
+    *id = atomic_load(&hislip_data->last_message_id);
+
+    return status;
+}
+
+int hislip_receive_response(void *data, unsigned int id, char *message, int length, int timeout)
+{
+    hislip_data_t *hislip_data = (hislip_data_t *) data;
+    long long deadline = time_ms() + timeout;
+
+    return receive_message(hislip_data, false, id, message, length, deadline);
+}
+
+int hislip_read_stb(void *data, int timeout)
+{
+    hislip_data_t *hislip_data = (hislip_data_t *) data;
+    long long deadline = time_ms() + timeout;
+    hislip_header_t header;
+
+    // May run concurrently with a transfer on the synchronous channel
+    if (async_transaction(hislip_data, HISLIP_ASYNC_STATUS_QUERY, rmt_control(hislip_data),
+                          atomic_load(&hislip_data->last_message_id), NULL, 0, HISLIP_ASYNC_STATUS_RESPONSE,
+                          &header, NULL, 0, deadline) != 0)
+        return -1;
+
+    // Status byte is returned in the control code
+    return header.control;
+}
+
+int hislip_trigger(void *data, int timeout, long long *sent)
+{
+    hislip_data_t *hislip_data = (hislip_data_t *) data;
+    long long deadline = time_ms() + timeout;
+
+    if (sent != NULL)
+        *sent = session_time_ns();
+
+    if (send_message(&hislip_data->sync, HISLIP_TRIGGER, rmt_control(hislip_data),
+                     hislip_data->message_id, NULL, 0, deadline) != 0)
+        return -1;
+
+    atomic_store(&hislip_data->last_message_id, hislip_data->message_id);
+    hislip_data->message_id += 2;
+
+    return 0;
+}
+
+static int device_clear(hislip_data_t *hislip_data, bool overlapped, long long deadline)
+{
+    hislip_channel_t *channel = &hislip_data->sync;
+    hislip_header_t header;
+
+    // Request device clear on asynchronous channel
+    if (async_transaction(hislip_data, HISLIP_ASYNC_DEVICE_CLEAR, 0, 0, NULL, 0,
+                          HISLIP_ASYNC_DEVICE_CLEAR_ACK, &header, NULL, 0, deadline) != 0)
+        return -1;
+
+    // Complete device clear on synchronous channel with requested mode
+    if (send_message(channel, HISLIP_DEVICE_CLEAR_COMPLETE, overlapped ? HISLIP_CONTROL_OVERLAPPED : 0,
+                     0, NULL, 0, deadline) != 0)
+        return -1;
+
+    // Any pending responses are flushed while waiting for acknowledge
+    if (receive_response(channel, HISLIP_DEVICE_CLEAR_ACKNOWLEDGE, &header, NULL, 0, deadline) != 0)
+        return -1;
+
+    pending_flush(hislip_data);
+    hislip_data->overlapped = header.control & HISLIP_CONTROL_OVERLAPPED;
+    hislip_data->message_id = HISLIP_MESSAGE_ID_INITIAL;
+    atomic_store(&hislip_data->last_message_id, HISLIP_MESSAGE_ID_INITIAL - 2);
+    atomic_store(&hislip_data->rmt_delivered, false);
+
+    return 0;
+}
+
+int hislip_clear(void *data, int timeout)
+{
+    hislip_data_t *hislip_data = (hislip_data_t *) data;
+
+    return device_clear(hislip_data, hislip_data->overlapped, time_ms() + timeout);
+}
+
+int hislip_set_overlapped(void *data, bool enable, int timeout)
+{
+    hislip_data_t *hislip_data = (hislip_data_t *) data;
+
+    // Mode can only be changed by device clear
+    if (device_clear(hislip_data, enable, time_ms() + timeout) != 0)
+        return -1;
+
+    if (hislip_data->overlapped != enable)
+    {
+        error_printf("Server does not support %s mode\n", enable ? "overlapped" : "synchronized");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int remote_local_control(hislip_data_t *hislip_data, uint8_t request, int timeout)
+{
+    hislip_header_t header;
+
+    return async_transaction(hislip_data, HISLIP_ASYNC_REMOTE_LOCAL_CONTROL, request,
+                             atomic_load(&hislip_data->last_message_id), NULL, 0,
+                             HISLIP_ASYNC_REMOTE_LOCAL_RESPONSE, &header, NULL, 0,
+                             time_ms() + timeout);
+}
+
+int hislip_remote(void *data, int timeout)
+{
+    return remote_local_control((hislip_data_t *) data, HISLIP_REMOTE_ENABLE_GO_REMOTE, timeout);
+}
+
+int hislip_local(void *data, int timeout)
+{
+    return remote_local_control((hislip_data_t *) data, HISLIP_REMOTE_GO_LOCAL, timeout);
+}
+
+int hislip_lock_shared(void *data, const char *name, int timeout)
+{
+    hislip_data_t *hislip_data = (hislip_data_t *) data;
+    hislip_header_t header;
+
+    // Server waits up to timeout for the lock so allow for round trip on top
+    if (async_transaction(hislip_data, HISLIP_ASYNC_LOCK, HISLIP_CONTROL_LOCK_REQUEST, timeout,
+                          name, strlen(name), HISLIP_ASYNC_LOCK_RESPONSE, &header, NULL, 0,
+                          time_ms() + timeout + HISLIP_TIMEOUT_MARGIN) != 0)
+        return -1;
+
+    switch (header.control)
+    {
+        case HISLIP_LOCK_SUCCESS:
+            return 0;
+        case HISLIP_LOCK_FAILURE:
+            error_printf("Lock timeout\n");
+            return -1;
+        default:
+            error_printf("Invalid lock request\n");
+            return -1;
+    }
+}
+
+int hislip_lock(void *data, int timeout)
+{
+    // Empty lock string requests exclusive lock
+    return hislip_lock_shared(data, "", timeout);
+}
+
+int hislip_unlock(void *data)
+{
+    hislip_data_t *hislip_data = (hislip_data_t *) data;
+    hislip_header_t header;
+
+    if (async_transaction(hislip_data, HISLIP_ASYNC_LOCK, HISLIP_CONTROL_LOCK_RELEASE,
+                          atomic_load(&hislip_data->last_message_id), NULL, 0, HISLIP_ASYNC_LOCK_RESPONSE,
+                          &header, NULL, 0, time_ms() + hislip_data->timeout) != 0)
+        return -1;
+
+    if ((header.control != HISLIP_LOCK_SUCCESS) && (header.control != HISLIP_LOCK_SUCCESS_SHARED))
+    {
+        error_printf("No lock held\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int hislip_enable_srq(void *data, int handle, void (*handler)(int handle))
+{
+    hislip_data_t *hislip_data = (hislip_data_t *) data;
+    int status = 0;
+
+    pthread_mutex_lock(&hislip_data->response_mutex);
+
+    hislip_data->srq_handle = handle;
+    hislip_data->srq_handler = handler;
+
+    // Service requests always arrive on the asynchronous channel, only start delivering them
+    if ((handler != NULL) && !hislip_data->srq_enabled)
+    {
+        if (pthread_create(&hislip_data->srq_thread, NULL, thread_srq, hislip_data) != 0)
+        {
+            error_printf("Failed to create thread\n");
+            status = -1;
+        }
+        else
+            hislip_data->srq_enabled = true;
+    }
+
+    pthread_mutex_unlock(&hislip_data->response_mutex);
+
+    return status;
+}
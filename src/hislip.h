@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2026  Martin Lund
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef HISLIP_H
+#define HISLIP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "tcp.h"
+
+#define HISLIP_ASYNC_PAYLOAD_MAX 256
+
+typedef struct
+{
+    uint8_t type;
+    uint8_t control;
+    uint32_t parameter;
+    uint64_t length;
+} hislip_header_t;
+
+typedef struct hislip_response
+{
+    uint32_t message_id;
+    char *data;
+    size_t length;
+    bool complete;
+    struct hislip_response *next;
+} hislip_response_t;
+
+typedef struct
+{
+    tcp_data_t tcp;
+    void *tls;
+    bool ktls_send;
+    pthread_mutex_t tls_mutex;
+} hislip_channel_t;
+
+typedef struct
+{
+    hislip_channel_t sync;
+    hislip_channel_t async;
+    uint16_t session_id;
+    uint16_t server_version;
+    uint32_t message_id;
+    atomic_uint last_message_id; // Read by asynchronous requests from other threads
+    uint64_t max_message_size;
+    atomic_bool rmt_delivered;
+    bool overlapped;
+    bool encrypted;
+    hislip_response_t *pending;
+    int timeout;
+    pthread_mutex_t async_mutex;
+    pthread_t async_thread;
+    pthread_mutex_t response_mutex;
+    pthread_cond_t response_cond;
+    hislip_header_t response;
+    uint8_t response_payload[HISLIP_ASYNC_PAYLOAD_MAX];
+    size_t response_length;
+    bool response_ready;
+    bool async_closing;
+    bool async_closed;
+    pthread_t srq_thread;
+    pthread_cond_t srq_cond;
+    bool srq_enabled;
+    int srq_pending;
+    int srq_handle;
+    void (*srq_handler)(int handle);
+} hislip_data_t;
+
+int hislip_connect(void *data, const char *address, int port, const char *name, int timeout);
+int hislip_tls_connect(void *data, const char *address, int port, const char *name, int timeout);
+int hislip_set_tls_ca(const char *ca_file);
+int hislip_disconnect(void *data);
+int hislip_send(void *data, const char *message, int length, int timeout);
+int hislip_receive(void *data, char *message, int length, int timeout);
+int hislip_send_query(void *data, const char *message, int length, unsigned int *id, int timeout);
+int hislip_receive_response(void *data, unsigned int id, char *message, int length, int timeout);
+int hislip_set_overlapped(void *data, bool enable, int timeout);
+int hislip_read_stb(void *data, int timeout);
+int hislip_trigger(void *data, int timeout, long long *sent);
+int hislip_clear(void *data, int timeout);
+int hislip_remote(void *data, int timeout);
+int hislip_local(void *data, int timeout);
+int hislip_lock(void *data, int timeout);
+int hislip_lock_shared(void *data, const char *name, int timeout);
+int hislip_unlock(void *data);
+int hislip_enable_srq(void *data, int handle, void (*handler)(int handle));
+
+#endif
@@ -0,0 +1,443 @@
+/*
+ * Copyright (c) 2017-2022  Martin Lund
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <libxml/parser.h>
+#include "identify.h"
+
+#define PORT_HTTP                80
+#define HTTP_BUFFER_SIZE       4096
+#define HTTP_HEADER_MAX        8192 // Status line and headers, anything larger is not an LXI device
+
+typedef enum
+{
+    BODY_LENGTH,        // Body framed by Content-Length
+    BODY_CLOSE,         // Body ends when connection closes
+    BODY_CHUNK_SIZE,    // Chunked encoding, reading chunk size line
+    BODY_CHUNK_DATA,    // Chunked encoding, reading chunk data
+    BODY_CHUNK_END,     // Chunked encoding, reading CRLF after chunk data
+    BODY_DONE
+} body_state_t;
+
+typedef struct
+{
+    identification_t *identification;
+    char *field;        // Field receiving text of current element, if any
+    int depth;
+    int found;
+} identify_sax_t;
+
+typedef struct
+{
+    body_state_t state;
+    long long remaining;
+    char line[32];
+    int line_length;
+} http_body_t;
+
+static pthread_once_t xml_once = PTHREAD_ONCE_INIT;
+
+static void xml_init(void)
+{
+    // Initialize libxml2 once before parsing from several threads. It is
+    // never cleaned up as other parts of the application may be using it.
+    xmlInitParser();
+}
+
+static long long time_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int wait_socket(int sockfd, short events, long long deadline)
+{
+    struct pollfd pfd = { .fd = sockfd, .events = events };
+    long long remaining;
+    int status;
+
+    do
+    {
+        remaining = deadline - time_ms();
+        if (remaining <= 0)
+            return -1;
+
+        status = poll(&pfd, 1, (int) remaining);
+    } while ((status < 0) && (errno == EINTR));
+
+    return (status > 0) ? 0 : -1;
+}
+
+static int http_connect(const char *address, long long deadline)
+{
+    struct sockaddr_in server_address;
+    socklen_t length = sizeof(int);
+    int sockfd;
+    int error = 0;
+
+    memset(&server_address, 0, sizeof(server_address));
+    server_address.sin_family = AF_INET;
+    server_address.sin_port = htons(PORT_HTTP);
+    if (inet_pton(AF_INET, address, &server_address.sin_addr) != 1)
+        return -1;
+
+    sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sockfd < 0)
+        return -1;
+
+    if ((connect(sockfd, (struct sockaddr *) &server_address, sizeof(server_address)) < 0) &&
+        (errno != EINPROGRESS))
+        goto error;
+
+    if (wait_socket(sockfd, POLLOUT, deadline) != 0)
+        goto error;
+
+    if ((getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &error, &length) != 0) || (error != 0))
+        goto error;
+
+    return sockfd;
+
+error:
+    close(sockfd);
+    return -1;
+}
+
+static int http_send(int sockfd, const char *request, int length, long long deadline)
+{
+    int n;
+
+    while (length > 0)
+    {
+        if (wait_socket(sockfd, POLLOUT, deadline) != 0)
+            return -1;
+
+        n = send(sockfd, request, length, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if ((errno == EAGAIN) || (errno == EINTR))
+                continue;
+            return -1;
+        }
+
+        request += n;
+        length -= n;
+    }
+
+    return 0;
+}
+
+static void sax_start_element(void *ctx, const xmlChar *localname, const xmlChar *prefix,
+        const xmlChar *uri, int nb_namespaces, const xmlChar **namespaces,
+        int nb_attributes, int nb_defaulted, const xmlChar **attributes)
+{
+    xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr) ctx;
+    identify_sax_t *sax = (identify_sax_t *) ctxt->_private;
+    identification_t *identification = sax->identification;
+    const char *name = (const char *) localname;
+
+    // Identification fields are children of root element
+    if (++sax->depth != 2)
+        return;
+
+    if (strcmp(name, "Manufacturer") == 0)
+        sax->field = identification->manufacturer;
+    else if (strcmp(name, "Model") == 0)
+        sax->field = identification->model;
+    else if (strcmp(name, "SerialNumber") == 0)
+        sax->field = identification->serial_number;
+    else if (strcmp(name, "FirmwareRevision") == 0)
+        sax->field = identification->firmware_revision;
+}
+
+static void sax_end_element(void *ctx, const xmlChar *localname, const xmlChar *prefix, const xmlChar *uri)
+{
+    xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr) ctx;
+    identify_sax_t *sax = (identify_sax_t *) ctxt->_private;
+
+    if ((sax->depth-- == 2) && (sax->field != NULL))
+    {
+        sax->field = NULL;
+
+        // Rest of document is of no interest once all fields are known
+        if (++sax->found == 4)
+            xmlStopParser(ctxt);
+    }
+}
+
+static void sax_characters(void *ctx, const xmlChar *text, int length)
+{
+    xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr) ctx;
+    identify_sax_t *sax = (identify_sax_t *) ctxt->_private;
+    int used;
+
+    if (sax->field == NULL)
+        return;
+
+    // Text may arrive in pieces
+    used = strlen(sax->field);
+    if (length > IDENTIFY_FIELD_MAX - 1 - used)
+        length = IDENTIFY_FIELD_MAX - 1 - used;
+    memcpy(sax->field + used, text, length);
+    sax->field[used + length] = 0;
+}
+
+#if LIBXML_VERSION >= 21200
+static void sax_error(void *ctx, const xmlError *error)
+#else
+static void sax_error(void *ctx, xmlErrorPtr error)
+#endif
+{
+    // Malformed documents are parsed as far as possible without reporting
+}
+
+// Feed body bytes to parser, decoding chunked transfer encoding if used
+static int http_body(http_body_t *body, xmlParserCtxtPtr ctxt, const char *data, int length)
+{
+    int n;
+
+    while ((length > 0) && (body->state != BODY_DONE))
+    {
+        switch (body->state)
+        {
+            case BODY_LENGTH:
+            case BODY_CHUNK_DATA:
+                n = (length < body->remaining) ? length : (int) body->remaining;
+                xmlParseChunk(ctxt, data, n, 0);
+                body->remaining -= n;
+                if (body->remaining == 0)
+                    body->state = (body->state == BODY_LENGTH) ? BODY_DONE : BODY_CHUNK_END;
+                break;
+
+            case BODY_CLOSE:
+                n = length;
+                xmlParseChunk(ctxt, data, n, 0);
+                break;
+
+            case BODY_CHUNK_SIZE:
+            case BODY_CHUNK_END:
+                n = 1;
+                if (*data != '\n')
+                {
+                    if (body->line_length < (int) sizeof(body->line) - 1)
+                        body->line[body->line_length++] = *data;
+                    break;
+                }
+
+                body->line[body->line_length] = 0;
+                body->line_length = 0;
+
+                if (body->state == BODY_CHUNK_END)
+                {
+                    body->state = BODY_CHUNK_SIZE;
+                    break;
+                }
+
+                // Chunk extensions follow size after ';' and are ignored
+                body->remaining = strtoll(body->line, NULL, 16);
+                if (body->remaining < 0)
+                    return -1;
+                body->state = (body->remaining == 0) ? BODY_DONE : BODY_CHUNK_DATA;
+                break;
+
+            default:
+                n = length;
+                break;
+        }
+
+        data += n;
+        length -= n;
+    }
+
+    return 0;
+}
+
+// Interpret status line and headers, returns offset of body or -1
+static int http_header(char *buffer, int length, http_body_t *body)
+{
+    char *end, *line, *next, *value;
+    int status;
+
+    buffer[length] = 0;
+    end = strstr(buffer, "\r\n\r\n");
+    if (end == NULL)
+        return 0;
+    *end = 0;
+
+    if ((sscanf(buffer, "HTTP/%*d.%*d %d", &status) != 1) || (status != 200))
+        return -1;
+
+    body->state = BODY_CLOSE;
+
+    for (line = strstr(buffer, "\r\n"); line != NULL; line = next)
+    {
+        line += 2;
+        next = strstr(line, "\r\n");
+        if (next != NULL)
+            *next = 0;
+
+        value = strchr(line, ':');
+        if (value == NULL)
+            continue;
+        *value++ = 0;
+        while ((*value == ' ') || (*value == '\t'))
+            value++;
+
+        if ((strcasecmp(line, "Transfer-Encoding") == 0) && (strcasestr(value, "chunked") != NULL))
+            body->state = BODY_CHUNK_SIZE;
+        else if ((strcasecmp(line, "Content-Length") == 0) && (body->state == BODY_CLOSE))
+        {
+            body->state = BODY_LENGTH;
+            body->remaining = strtoll(value, NULL, 10);
+            if (body->remaining <= 0)
+                return -1;
+        }
+    }
+
+    return end + 4 - buffer;
+}
+
+int identify_http(const char *address, identification_t *identification, int timeout)
+{
+    char buffer[HTTP_HEADER_MAX + 1];
+    char request[128 + INET6_ADDRSTRLEN];
+    http_body_t body = { .state = BODY_DONE };
+    identify_sax_t sax = { .identification = identification };
+    xmlSAXHandler handler;
+    xmlParserCtxtPtr ctxt = NULL;
+    long long deadline = time_ms() + timeout;
+    int header_length = 0;
+    int received = 0;
+    int status = -1;
+    int sockfd;
+    int n;
+
+    pthread_once(&xml_once, xml_init);
+
+    memset(identification, 0, sizeof(identification_t));
+
+    sockfd = http_connect(address, deadline);
+    if (sockfd < 0)
+        return -1;
+
+    snprintf(request, sizeof(request),
+            "GET /lxi/identification HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n", address);
+    if (http_send(sockfd, request, strlen(request), deadline) != 0)
+        goto error;
+
+    // Parser only reports elements of interest, no document tree is built
+    memset(&handler, 0, sizeof(handler));
+    handler.initialized = XML_SAX2_MAGIC;
+    handler.startElementNs = sax_start_element;
+    handler.endElementNs = sax_end_element;
+    handler.characters = sax_characters;
+    handler.serror = sax_error;
+
+    ctxt = xmlCreatePushParserCtxt(&handler, NULL, NULL, 0, NULL);
+    if (ctxt == NULL)
+        goto error;
+    ctxt->_private = &sax;
+    xmlCtxtUseOptions(ctxt, XML_PARSE_RECOVER | XML_PARSE_NONET | XML_PARSE_NOERROR | XML_PARSE_NOWARNING);
+
+    // Receive header, then parse body as it arrives
+    while ((header_length == 0) || ((body.state != BODY_DONE) && !ctxt->disableSAX && (sax.found < 4)))
+    {
+        if (wait_socket(sockfd, POLLIN, deadline) != 0)
+            goto error;
+
+        if (header_length == 0)
+            n = recv(sockfd, buffer + received, HTTP_HEADER_MAX - received, 0);
+        else
+            n = recv(sockfd, buffer, HTTP_BUFFER_SIZE, 0);
+
+        if (n < 0)
+        {
+            if ((errno == EAGAIN) || (errno == EINTR))
+                continue;
+            goto error;
+        }
+
+        if (n == 0)
+        {
+            // Connection closed by device
+            if ((header_length == 0) || ((body.state != BODY_CLOSE) && (sax.found == 0)))
+                goto error;
+            break;
+        }
+
+        if (header_length == 0)
+        {
+            received += n;
+            header_length = http_header(buffer, received, &body);
+            if (header_length < 0)
+                goto error;
+            if (header_length == 0)
+            {
+                if (received == HTTP_HEADER_MAX)
+                    goto error;
+                continue;
+            }
+
+            // Part of body may have arrived along with header
+            if (http_body(&body, ctxt, buffer + header_length, received - header_length) != 0)
+                goto error;
+        }
+        else if (http_body(&body, ctxt, buffer, n) != 0)
+            goto error;
+    }
+
+    xmlParseChunk(ctxt, NULL, 0, 1);
+
+    if (sax.found > 0)
+        status = 0;
+
+error:
+    if (ctxt != NULL)
+        xmlFreeParserCtxt(ctxt);
+    close(sockfd);
+
+    return status;
+}
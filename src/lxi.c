@@ -33,15 +33,41 @@
 #include <stdbool.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
 #include <lxi.h>
 #include "error.h"
 #include "session.h"
 #include "vxi11.h"
 #include "tcp.h"
+#include "hislip.h"
+#include "cache.h"
+#include "watch.h"
+#include "collect.h"
 #include "mdns.h"
+#include "until.h"
+#include "transport.h"
+#include "pipeline.h"
 
 #define EXPORT __attribute__((visibility("default")))
 
+typedef struct
+{
+    atomic_int ready;
+    atomic_bool go;
+} trigger_gate_t;
+
+typedef struct
+{
+    trigger_gate_t *gate;
+    int (*trigger)(void *data, int timeout, long long *sent);
+    void *data;
+    int timeout;
+    long long timestamp;
+    int status;
+} thread_trigger_args_t;
+
 static struct session_t session[SESSIONS_MAX] = {};
 static pthread_mutex_t session_mutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -69,7 +95,8 @@ bool is_valid_session(int device)
     {
         pthread_mutex_lock(&session_mutex);
 
-        if (session[device].allocated == false)
+        // Sessions still connecting are not usable yet
+        if ((session[device].allocated == false) || (session[device].connected == false))
         {
             status = false;
         }
@@ -80,6 +107,25 @@ bool is_valid_session(int device)
     return status;
 }
 
+static void srq_dispatch(int device)
+{
+    void (*callback)(int device) = NULL;
+
+    if ((device < 0) || (device >= SESSIONS_MAX))
+        return;
+
+    pthread_mutex_lock(&session_mutex);
+
+    if (session[device].allocated)
+        callback = session[device].srq_callback;
+
+    pthread_mutex_unlock(&session_mutex);
+
+    // Notify service request via callback
+    if (callback != NULL)
+        callback(device);
+}
+
 EXPORT int lxi_init(void)
 {
     int i;
@@ -125,19 +171,65 @@ EXPORT int lxi_connect(const char *address, int port, const char *name, int time
         session[i].connect = vxi11_connect;
         session[i].send = vxi11_send;
         session[i].receive = vxi11_receive;
+        session[i].send_query = NULL;
+        session[i].receive_response = NULL;
+        session[i].set_overlapped = NULL;
         session[i].disconnect = vxi11_disconnect;
+        session[i].set_termchar = vxi11_set_termchar;
+        session[i].abort = vxi11_abort;
+        session[i].read_stb = vxi11_read_stb;
+        session[i].trigger = vxi11_trigger;
+        session[i].clear = vxi11_clear;
+        session[i].remote = vxi11_remote;
+        session[i].local = vxi11_local;
+        session[i].lock = vxi11_lock;
+        session[i].lock_shared = NULL;
+        session[i].unlock = vxi11_unlock;
+        session[i].enable_srq = vxi11_enable_srq;
         session[i].data = malloc(sizeof(vxi11_data_t));
         break;
     case RAW:
         session[i].connect = tcp_connect;
         session[i].send = tcp_send;
         session[i].receive = tcp_receive;
+        session[i].send_query = NULL;
+        session[i].receive_response = NULL;
+        session[i].set_overlapped = NULL;
         session[i].disconnect = tcp_disconnect;
+        session[i].set_termchar = NULL;
+        session[i].abort = NULL;
+        session[i].read_stb = tcp_read_stb;
+        session[i].trigger = tcp_trigger;
+        session[i].clear = NULL;
+        session[i].remote = NULL;
+        session[i].local = NULL;
+        session[i].lock = NULL;
+        session[i].lock_shared = NULL;
+        session[i].unlock = NULL;
+        session[i].enable_srq = NULL;
         session[i].data = malloc(sizeof(tcp_data_t));
         break;
     case HISLIP:
-        // Error: Not yet supported
-        goto error_protocol;
+    case HISLIP_TLS:
+        session[i].connect = (protocol == HISLIP_TLS) ? hislip_tls_connect : hislip_connect;
+        session[i].send = hislip_send;
+        session[i].receive = hislip_receive;
+        session[i].send_query = hislip_send_query;
+        session[i].receive_response = hislip_receive_response;
+        session[i].set_overlapped = hislip_set_overlapped;
+        session[i].disconnect = hislip_disconnect;
+        session[i].set_termchar = NULL;
+        session[i].abort = NULL;
+        session[i].read_stb = hislip_read_stb;
+        session[i].trigger = hislip_trigger;
+        session[i].clear = hislip_clear;
+        session[i].remote = hislip_remote;
+        session[i].local = hislip_local;
+        session[i].lock = hislip_lock;
+        session[i].lock_shared = hislip_lock_shared;
+        session[i].unlock = hislip_unlock;
+        session[i].enable_srq = hislip_enable_srq;
+        session[i].data = malloc(sizeof(hislip_data_t));
         break;
     default:
         // Error: Unknown protocol
@@ -145,27 +237,58 @@ EXPORT int lxi_connect(const char *address, int port, const char *name, int time
         break;
     }
 
+    session[i].srq_callback = NULL;
+
+    // Reserve session so other sessions can be connected meanwhile
+    session[i].allocated = true;
+    pthread_mutex_unlock(&session_mutex);
+
     // Connect
-    if (session[i].connect(session[i].data, address, port, name, timeout) != 0)
+    if ((session[i].data == NULL) ||
+        (session[i].connect(session[i].data, address, port, name, timeout) != 0))
         goto error_connect;
 
-    session[i].allocated = true;
+    pthread_mutex_lock(&session_mutex);
     session[i].connected = true;
-
     pthread_mutex_unlock(&session_mutex);
 
     // Return session handle
     return i;
 
 error_connect:
-    if (session[i].data)
-        free(session[i].data);
+    pthread_mutex_lock(&session_mutex);
+    free(session[i].data);
+    session[i].data = NULL;
+    session[i].allocated = false;
 error_protocol:
 error_session:
     pthread_mutex_unlock(&session_mutex);
     return LXI_ERROR;
 }
 
+EXPORT int lxi_connect_auto(const char *address, const char *name, int timeout, lxi_transport_t *transport)
+{
+    lxi_transport_t transport_local;
+
+    if (address == NULL)
+        return LXI_ERROR;
+
+    // Details of why a transport was picked are optional
+    if (transport == NULL)
+        transport = &transport_local;
+
+    return transport_connect(address, name, timeout, transport);
+}
+
+EXPORT int lxi_set_tls_ca(const char *ca_file)
+{
+    // Applies to encrypted sessions connected hereafter
+    if (hislip_set_tls_ca(ca_file) != 0)
+        return LXI_ERROR;
+
+    return LXI_OK;
+}
+
 EXPORT int lxi_disconnect(int device)
 {
     if (is_valid_session(device) == false)
@@ -177,6 +300,8 @@ EXPORT int lxi_disconnect(int device)
     if (session[device].connected)
         session[device].disconnect(session[device].data);
 
+    session[device].srq_callback = NULL;
+
     // Free resources
     free(session[device].data);
 
@@ -220,6 +345,348 @@ EXPORT int lxi_receive(int device, char *message, int length, int timeout)
     return bytes_received;
 }
 
+EXPORT int lxi_send_query(int device, const char *message, int length, unsigned int *id, int timeout)
+{
+    int bytes_sent;
+
+    if (is_valid_session(device) == false)
+        return LXI_ERROR;
+
+    // Not all protocols support identifying responses
+    if (session[device].send_query == NULL)
+        return LXI_ERROR;
+
+    // Send query
+    bytes_sent = session[device].send_query(session[device].data, message, length, id, timeout);
+    if (bytes_sent < 0)
+        return LXI_ERROR;
+
+    // Return number of bytes sent
+    return bytes_sent;
+}
+
+EXPORT int lxi_receive_response(int device, unsigned int id, char *message, int length, int timeout)
+{
+    int bytes_received;
+
+    if (is_valid_session(device) == false)
+        return LXI_ERROR;
+
+    // Not all protocols support identifying responses
+    if (session[device].receive_response == NULL)
+        return LXI_ERROR;
+
+    // Receive response to query
+    bytes_received = session[device].receive_response(session[device].data, id, message, length, timeout);
+    if (bytes_received < 0)
+        return LXI_ERROR;
+
+    // Return number of bytes received
+    return bytes_received;
+}
+
+EXPORT int lxi_set_overlapped(int device, int enable, int timeout)
+{
+    if (is_valid_session(device) == false)
+        return LXI_ERROR;
+
+    // Not all protocols support overlapped mode
+    if (session[device].set_overlapped == NULL)
+        return LXI_ERROR;
+
+    // Switch mode
+    if (session[device].set_overlapped(session[device].data, enable != 0, timeout) != 0)
+        return LXI_ERROR;
+
+    return LXI_OK;
+}
+
+EXPORT int lxi_set_termchar(int device, int termchar)
+{
+    if (is_valid_session(device) == false)
+        return LXI_ERROR;
+
+    // Only a single byte or none is a valid termination character
+    if ((termchar != LXI_TERMCHAR_NONE) && ((termchar < 0) || (termchar > 255)))
+        return LXI_ERROR;
+
+    // Not all protocols support termination characters
+    if (session[device].set_termchar == NULL)
+        return LXI_ERROR;
+
+    if (session[device].set_termchar(session[device].data, termchar) != 0)
+        return LXI_ERROR;
+
+    return LXI_OK;
+}
+
+EXPORT int lxi_abort(int device)
+{
+    if (is_valid_session(device) == false)
+        return LXI_ERROR;
+
+    // Not all protocols support aborting operations
+    if (session[device].abort == NULL)
+        return LXI_ERROR;
+
+    // Abort in-progress operation (may be called from any thread)
+    if (session[device].abort(session[device].data) != 0)
+        return LXI_ERROR;
+
+    return LXI_OK;
+}
+
+EXPORT int lxi_on_srq(int device, void (*callback)(int device))
+{
+    if (is_valid_session(device) == false)
+        return LXI_ERROR;
+
+    // Not all protocols support service requests
+    if (session[device].enable_srq == NULL)
+        return LXI_ERROR;
+
+    pthread_mutex_lock(&session_mutex);
+    session[device].srq_callback = callback;
+    pthread_mutex_unlock(&session_mutex);
+
+    // Enable service requests, or disable them if no callback is given
+    if (session[device].enable_srq(session[device].data, device, callback ? srq_dispatch : NULL) != 0)
+    {
+        pthread_mutex_lock(&session_mutex);
+        session[device].srq_callback = NULL;
+        pthread_mutex_unlock(&session_mutex);
+        return LXI_ERROR;
+    }
+
+    return LXI_OK;
+}
+
+EXPORT int lxi_read_stb(int device, int timeout)
+{
+    int stb;
+
+    if (is_valid_session(device) == false)
+        return LXI_ERROR;
+
+    // Not all protocols support reading the status byte
+    if (session[device].read_stb == NULL)
+        return LXI_ERROR;
+
+    // Read status byte
+    stb = session[device].read_stb(session[device].data, timeout);
+    if (stb < 0)
+        return LXI_ERROR;
+
+    // Return status byte
+    return stb;
+}
+
+EXPORT int lxi_trigger(int device, int timeout)
+{
+    if (is_valid_session(device) == false)
+        return LXI_ERROR;
+
+    // Not all protocols support triggering
+    if (session[device].trigger == NULL)
+        return LXI_ERROR;
+
+    // Trigger
+    if (session[device].trigger(session[device].data, timeout, NULL) != 0)
+        return LXI_ERROR;
+
+    return LXI_OK;
+}
+
+EXPORT int lxi_clear(int device, int timeout)
+{
+    if (is_valid_session(device) == false)
+        return LXI_ERROR;
+
+    // Not all protocols support device clear
+    if (session[device].clear == NULL)
+        return LXI_ERROR;
+
+    // Clear
+    if (session[device].clear(session[device].data, timeout) != 0)
+        return LXI_ERROR;
+
+    return LXI_OK;
+}
+
+EXPORT int lxi_remote(int device, int timeout)
+{
+    if (is_valid_session(device) == false)
+        return LXI_ERROR;
+
+    // Not all protocols support remote control
+    if (session[device].remote == NULL)
+        return LXI_ERROR;
+
+    // Go to remote
+    if (session[device].remote(session[device].data, timeout) != 0)
+        return LXI_ERROR;
+
+    return LXI_OK;
+}
+
+EXPORT int lxi_local(int device, int timeout)
+{
+    if (is_valid_session(device) == false)
+        return LXI_ERROR;
+
+    // Not all protocols support local control
+    if (session[device].local == NULL)
+        return LXI_ERROR;
+
+    // Go to local
+    if (session[device].local(session[device].data, timeout) != 0)
+        return LXI_ERROR;
+
+    return LXI_OK;
+}
+
+EXPORT int lxi_lock(int device, int timeout)
+{
+    if (is_valid_session(device) == false)
+        return LXI_ERROR;
+
+    // Not all protocols support locking
+    if (session[device].lock == NULL)
+        return LXI_ERROR;
+
+    // Lock device, waiting up to timeout for other locks to be released
+    if (session[device].lock(session[device].data, timeout) != 0)
+        return LXI_ERROR;
+
+    return LXI_OK;
+}
+
+EXPORT int lxi_lock_shared(int device, const char *name, int timeout)
+{
+    if (is_valid_session(device) == false)
+        return LXI_ERROR;
+
+    // Not all protocols support shared locks
+    if ((session[device].lock_shared == NULL) || (name == NULL) || (name[0] == 0))
+        return LXI_ERROR;
+
+    // Lock device shared with clients using same lock name
+    if (session[device].lock_shared(session[device].data, name, timeout) != 0)
+        return LXI_ERROR;
+
+    return LXI_OK;
+}
+
+EXPORT int lxi_unlock(int device)
+{
+    if (is_valid_session(device) == false)
+        return LXI_ERROR;
+
+    // Not all protocols support locking
+    if (session[device].unlock == NULL)
+        return LXI_ERROR;
+
+    // Unlock device
+    if (session[device].unlock(session[device].data) != 0)
+        return LXI_ERROR;
+
+    return LXI_OK;
+}
+
+static void *thread_trigger(void *ptr)
+{
+    thread_trigger_args_t *args = (thread_trigger_args_t *) ptr;
+
+    // Report ready and spin until all triggers are released at once
+    atomic_fetch_add(&args->gate->ready, 1);
+    while (!atomic_load(&args->gate->go))
+        sched_yield();
+
+    // Backend stamps the time right before its request goes out
+    args->status = args->trigger(args->data, args->timeout, &args->timestamp);
+
+    return NULL;
+}
+
+EXPORT int lxi_group_trigger(const int *devices, int count, int timeout, long long *timestamps)
+{
+    thread_trigger_args_t *args;
+    pthread_t *threads;
+    trigger_gate_t gate;
+    int status = LXI_OK;
+    int started = 0;
+    int i, j;
+
+    if ((devices == NULL) || (count <= 0))
+        return LXI_ERROR;
+
+    for (i = 0; i < count; i++)
+    {
+        if ((is_valid_session(devices[i]) == false) || (session[devices[i]].trigger == NULL))
+            return LXI_ERROR;
+
+        // Sessions are not safe to drive from two threads at once
+        for (j = 0; j < i; j++)
+        {
+            if (devices[j] == devices[i])
+            {
+                error_printf("Device %d listed more than once\n", devices[i]);
+                return LXI_ERROR;
+            }
+        }
+    }
+
+    args = calloc(count, sizeof(thread_trigger_args_t));
+    threads = calloc(count, sizeof(pthread_t));
+    if ((args == NULL) || (threads == NULL))
+    {
+        status = LXI_ERROR;
+        goto error_alloc;
+    }
+
+    atomic_init(&gate.ready, 0);
+    atomic_init(&gate.go, false);
+
+    // Stage one trigger thread per device so all requests are ready to go
+    for (started = 0; started < count; started++)
+    {
+        args[started].gate = &gate;
+        args[started].trigger = session[devices[started]].trigger;
+        args[started].data = session[devices[started]].data;
+        args[started].timeout = timeout;
+        args[started].status = -1;
+
+        if (pthread_create(&threads[started], NULL, thread_trigger, &args[started]) != 0)
+        {
+            error_printf("Error pthread_create()\n");
+            status = LXI_ERROR;
+            break;
+        }
+    }
+
+    // Release all triggers simultaneously once every thread is waiting
+    while (atomic_load(&gate.ready) < started)
+        sched_yield();
+    atomic_store(&gate.go, true);
+
+    for (i = 0; i < started; i++)
+    {
+        pthread_join(threads[i], NULL);
+
+        if (args[i].status != 0)
+            status = LXI_ERROR;
+
+        // Return send time of each trigger so skew can be measured
+        if (timestamps != NULL)
+            timestamps[i] = args[i].timestamp;
+    }
+
+error_alloc:
+    free(threads);
+    free(args);
+    return status;
+}
+
 EXPORT int lxi_discover(lxi_info_t *info, int timeout, lxi_discover_t type)
 {
     switch (type)
@@ -230,6 +697,10 @@ EXPORT int lxi_discover(lxi_info_t *info, int timeout, lxi_discover_t type)
     case DISCOVER_MDNS:
         mdns_discover(info, timeout);
         break;
+    case DISCOVER_ALL:
+        vxi11_discover(info, timeout);
+        mdns_discover(info, timeout);
+        break;
     default:
         error_printf("Unknown discover type (%d)\n", type);
         return LXI_ERROR;
@@ -238,6 +709,154 @@ EXPORT int lxi_discover(lxi_info_t *info, int timeout, lxi_discover_t type)
     return LXI_OK;
 }
 
+EXPORT int lxi_discover_mdns(lxi_mdns_info_t *info, int timeout)
+{
+    return lxi_discover_mdns_if(info, NULL, FAMILY_IPV4, timeout);
+}
+
+EXPORT int lxi_discover_mdns_if(lxi_mdns_info_t *info, const char *ifname, lxi_family_t family, int timeout)
+{
+    if (info == NULL)
+        return LXI_ERROR;
+
+    if ((family != FAMILY_IPV4) && (family != FAMILY_IPV6) && (family != FAMILY_ANY))
+    {
+        error_printf("Unknown address family (%d)\n", family);
+        return LXI_ERROR;
+    }
+
+    // Services are reported along with their TXT records
+    if (mdns_discover_txt(info, ifname, family, timeout) != 0)
+        return LXI_ERROR;
+
+    return LXI_OK;
+}
+
+EXPORT int lxi_discover_until(lxi_info_t *info, const char *ifname, int timeout, lxi_discover_t type,
+                              const lxi_discover_until_t *until)
+{
+    int status;
+
+    if ((info == NULL) || (until == NULL))
+        return LXI_ERROR;
+
+    if ((type != DISCOVER_VXI11) && (type != DISCOVER_MDNS) && (type != DISCOVER_ALL))
+    {
+        error_printf("Unknown discover type (%d)\n", type);
+        return LXI_ERROR;
+    }
+
+    // Return early once the devices looked for have been found
+    status = until_discover(info, ifname, timeout, type, until);
+    if (status < 0)
+        return LXI_ERROR;
+
+    return status;
+}
+
+EXPORT int lxi_discover_sweep(lxi_info_t *info, const char *ranges, int rate, int timeout, int probe_tcp)
+{
+    if ((info == NULL) || (ranges == NULL))
+        return LXI_ERROR;
+
+    // Probe each address directly where broadcasts do not reach
+    if (vxi11_discover_sweep(info, ranges, rate, timeout, probe_tcp != 0) != 0)
+        return LXI_ERROR;
+
+    return LXI_OK;
+}
+
+EXPORT int lxi_discover_collect(lxi_device_t **devices, int timeout, lxi_discover_t type)
+{
+    int count;
+
+    if (devices == NULL)
+        return LXI_ERROR;
+
+    if ((type != DISCOVER_VXI11) && (type != DISCOVER_MDNS) && (type != DISCOVER_ALL))
+    {
+        error_printf("Unknown discover type (%d)\n", type);
+        return LXI_ERROR;
+    }
+
+    // Merge results per device into one block owned by caller
+    count = collect_devices(devices, timeout, type);
+    if (count < 0)
+        return LXI_ERROR;
+
+    return count;
+}
+
+EXPORT void lxi_discover_free(lxi_device_t *devices)
+{
+    free(devices);
+}
+
+EXPORT int lxi_discover_connect(lxi_connection_t **connections, int timeout, lxi_discover_t type,
+                                const char *match, const char *init)
+{
+    int count;
+
+    if (connections == NULL)
+        return LXI_ERROR;
+
+    if ((type != DISCOVER_VXI11) && (type != DISCOVER_MDNS) && (type != DISCOVER_ALL))
+    {
+        error_printf("Unknown discover type (%d)\n", type);
+        return LXI_ERROR;
+    }
+
+    // Connect devices while discovery is still going on
+    count = pipeline_connect(connections, timeout, type, match, init);
+    if (count < 0)
+        return LXI_ERROR;
+
+    return count;
+}
+
+EXPORT void lxi_discover_connect_free(lxi_connection_t *connections)
+{
+    free(connections);
+}
+
+EXPORT int lxi_discover_watch(lxi_watch_info_t *info, int timeout, int interval, lxi_discover_t type)
+{
+    int watch;
+
+    if (info == NULL)
+        return LXI_ERROR;
+
+    if ((type != DISCOVER_VXI11) && (type != DISCOVER_MDNS))
+    {
+        error_printf("Unknown discover type (%d)\n", type);
+        return LXI_ERROR;
+    }
+
+    // Search repeatedly in background until cancelled
+    watch = watch_start(info, timeout, interval, type);
+    if (watch < 0)
+        return LXI_ERROR;
+
+    return watch;
+}
+
+EXPORT int lxi_discover_cancel(int watch)
+{
+    if (watch_cancel(watch) != 0)
+        return LXI_ERROR;
+
+    return LXI_OK;
+}
+
+EXPORT int lxi_set_discover_cache(const char *path)
+{
+    // Applies to VXI-11 discoveries started hereafter
+    if (cache_set_path(path) != 0)
+        return LXI_ERROR;
+
+    return LXI_OK;
+}
+
 EXPORT int lxi_discover_if(lxi_info_t *info, const char *ifname, int timeout, lxi_discover_t type)
 {
     switch (type)
@@ -249,7 +868,17 @@ EXPORT int lxi_discover_if(lxi_info_t *info, const char *ifname, int timeout, lx
             vxi11_discover_if(info, ifname, timeout);
         break;
     case DISCOVER_MDNS:
-        mdns_discover(info, timeout);
+        // Fails for unknown interface name
+        if (mdns_discover_if(info, ifname, timeout) != 0)
+            return LXI_ERROR;
+        break;
+    case DISCOVER_ALL:
+        if (ifname == NULL)
+            vxi11_discover(info, timeout);
+        else
+            vxi11_discover_if(info, ifname, timeout);
+        if (mdns_discover_if(info, ifname, timeout) != 0)
+            return LXI_ERROR;
         break;
     default:
         error_printf("Unknown discover type (%d)\n", type);
@@ -39,6 +39,8 @@ extern "C"
 #define LXI_OK 0
 #define LXI_ERROR -1
 
+#define LXI_TERMCHAR_NONE -1
+
     typedef struct
     {
         const char *broadcast_type;
@@ -54,25 +56,137 @@ extern "C"
         void (*service)(const char *address, const char *id, const char *service, int port);
     } lxi_info_t;
 
+    typedef struct
+    {
+        const char *key;
+        const char *value;
+    } lxi_txt_t;
+
+    typedef struct
+    {
+        void (*service)(const char *address, const char *id, const char *service, int port,
+                        const lxi_txt_t *txt, int txt_count);
+    } lxi_mdns_info_t;
+
     typedef enum
     {
         VXI11,
         RAW,
-        HISLIP
+        HISLIP,
+        HISLIP_TLS
     } lxi_protocol_t;
 
+#define LXI_TRANSPORT_PROBES_MAX 3
+
+    typedef struct
+    {
+        lxi_protocol_t protocol;
+        int port;
+        int status;
+        int latency;
+    } lxi_transport_probe_t;
+
+    typedef struct
+    {
+        lxi_protocol_t protocol;
+        int port;
+        int cached;
+        lxi_transport_probe_t probes[LXI_TRANSPORT_PROBES_MAX];
+        int probe_count;
+    } lxi_transport_t;
+
     typedef enum
     {
         DISCOVER_VXI11,
-        DISCOVER_MDNS
+        DISCOVER_MDNS,
+        DISCOVER_ALL
     } lxi_discover_t;
 
+    typedef enum
+    {
+        FAMILY_IPV4,
+        FAMILY_IPV6,
+        FAMILY_ANY
+    } lxi_family_t;
+
+    typedef struct
+    {
+        int count;
+        const char *match;
+        int all_for_now;
+    } lxi_discover_until_t;
+
+    typedef struct
+    {
+        const char *name;
+        int port;
+    } lxi_device_service_t;
+
+    typedef struct
+    {
+        const char *address;
+        const char *id;
+        const lxi_device_service_t *services;
+        int service_count;
+    } lxi_device_t;
+
+    typedef struct
+    {
+        const char *address;
+        const char *id;
+        int device;
+        lxi_protocol_t protocol;
+    } lxi_connection_t;
+
+    typedef enum
+    {
+        LXI_ADDED,
+        LXI_REMOVED,
+        LXI_CHANGED
+    } lxi_event_t;
+
+    typedef struct
+    {
+        void (*device)(lxi_event_t event, const char *address, const char *id);
+        void (*service)(lxi_event_t event, const char *address, const char *id, const char *service, int port);
+    } lxi_watch_info_t;
+
     int lxi_init(void);
     int lxi_discover(lxi_info_t *info, int timeout, lxi_discover_t type);
     int lxi_discover_if(lxi_info_t *info, const char *ifname, int timeout, lxi_discover_t type);
+    int lxi_discover_mdns(lxi_mdns_info_t *info, int timeout);
+    int lxi_discover_mdns_if(lxi_mdns_info_t *info, const char *ifname, lxi_family_t family, int timeout);
+    int lxi_discover_until(lxi_info_t *info, const char *ifname, int timeout, lxi_discover_t type,
+                           const lxi_discover_until_t *until);
+    int lxi_discover_sweep(lxi_info_t *info, const char *ranges, int rate, int timeout, int probe_tcp);
+    int lxi_discover_collect(lxi_device_t **devices, int timeout, lxi_discover_t type);
+    void lxi_discover_free(lxi_device_t *devices);
+    int lxi_discover_connect(lxi_connection_t **connections, int timeout, lxi_discover_t type,
+                             const char *match, const char *init);
+    void lxi_discover_connect_free(lxi_connection_t *connections);
+    int lxi_discover_watch(lxi_watch_info_t *info, int timeout, int interval, lxi_discover_t type);
+    int lxi_discover_cancel(int watch);
+    int lxi_set_discover_cache(const char *path);
     int lxi_connect(const char *address, int port, const char *name, int timeout, lxi_protocol_t protocol);
+    int lxi_connect_auto(const char *address, const char *name, int timeout, lxi_transport_t *transport);
+    int lxi_set_tls_ca(const char *ca_file);
     int lxi_send(int device, const char *message, int length, int timeout);
     int lxi_receive(int device, char *message, int length, int timeout);
+    int lxi_send_query(int device, const char *message, int length, unsigned int *id, int timeout);
+    int lxi_receive_response(int device, unsigned int id, char *message, int length, int timeout);
+    int lxi_set_overlapped(int device, int enable, int timeout);
+    int lxi_set_termchar(int device, int termchar);
+    int lxi_abort(int device);
+    int lxi_on_srq(int device, void (*callback)(int device));
+    int lxi_read_stb(int device, int timeout);
+    int lxi_trigger(int device, int timeout);
+    int lxi_clear(int device, int timeout);
+    int lxi_remote(int device, int timeout);
+    int lxi_local(int device, int timeout);
+    int lxi_lock(int device, int timeout);
+    int lxi_lock_shared(int device, const char *name, int timeout);
+    int lxi_unlock(int device);
+    int lxi_group_trigger(const int *devices, int count, int timeout, long long *timestamps);
     int lxi_disconnect(int device);
 
 #ifdef __cplusplus
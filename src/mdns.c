@@ -30,6 +30,12 @@
 
 #include <lxi.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <net/if.h>
+#include "mdns.h"
+#include "error.h"
 
 #ifdef HAVE_AVAHI
 #include "avahi.h"
@@ -43,15 +49,107 @@
 #include "cygwin_dnssd.h"
 #endif
 
+#if !defined(HAVE_AVAHI) && !defined(HAVE_BONJOUR) && !defined(HAVE_CYGWIN_DNSSD)
+#include "querier.h"
+#endif
+
+// Index of named network interface, 0 for all interfaces
+static int mdns_interface(const char *ifname, unsigned int *interface)
+{
+    *interface = 0;
+    if (ifname == NULL)
+        return 0;
+
+    *interface = if_nametoindex(ifname);
+    if (*interface == 0)
+    {
+        error_printf("Unknown network interface (%s)\n", ifname);
+        return -1;
+    }
+
+    return 0;
+}
+
 int mdns_discover(lxi_info_t *info, int timeout)
 {
+    return mdns_discover_if(info, NULL, timeout);
+}
+
+int mdns_discover_if(lxi_info_t *info, const char *ifname, int timeout)
+{
+    unsigned int interface;
+
+    if (mdns_interface(ifname, &interface) != 0)
+        return -1;
+
 #ifdef HAVE_AVAHI
-    return avahi_discover(info, timeout);
+    return avahi_discover(info, interface, timeout);
 #elif defined(HAVE_BONJOUR)
-    return bonjour_discover(info, timeout);
+    return bonjour_discover(info, interface, timeout);
 #elif defined(HAVE_CYGWIN_DNSSD)
-    return cygwin_dnssd_discover(info, timeout);
+    return cygwin_dnssd_discover(info, interface, timeout);
 #else
-    return 0;
+    return querier_discover(info, interface, timeout);
 #endif
 }
+
+int mdns_discover_txt(lxi_mdns_info_t *info, const char *ifname, lxi_family_t family, int timeout)
+{
+    unsigned int interface;
+
+    if (mdns_interface(ifname, &interface) != 0)
+        return -1;
+
+#ifdef HAVE_AVAHI
+    return avahi_discover_txt(info, interface, family, timeout);
+#elif defined(HAVE_BONJOUR)
+    return bonjour_discover_txt(info, interface, family, timeout);
+#elif defined(HAVE_CYGWIN_DNSSD)
+    return cygwin_dnssd_discover_txt(info, interface, family, timeout);
+#else
+    return querier_discover_txt(info, interface, family, timeout);
+#endif
+}
+
+int mdns_watch(mdns_watch_t *watch, int interval)
+{
+#ifdef HAVE_AVAHI
+    return avahi_watch(watch, interval);
+#else
+    // No persistent browsing, searched in rounds instead
+    return -1;
+#endif
+}
+
+static const char *mdns_txt_value(const lxi_txt_t *txt, int count, const char *key)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        if (strcasecmp(txt[i].key, key) == 0)
+            return (txt[i].value != NULL) ? txt[i].value : "";
+    }
+
+    return NULL;
+}
+
+// Identification in *IDN? format from keys announced by LXI devices, if present
+int mdns_txt_id(const lxi_txt_t *txt, int count, char *id, size_t size)
+{
+    const char *manufacturer, *model, *serial_number, *firmware_version;
+
+    manufacturer = mdns_txt_value(txt, count, "Manufacturer");
+    model = mdns_txt_value(txt, count, "Model");
+    if ((manufacturer == NULL) || (model == NULL))
+        return -1;
+
+    serial_number = mdns_txt_value(txt, count, "SerialNumber");
+    firmware_version = mdns_txt_value(txt, count, "FirmwareVersion");
+
+    snprintf(id, size, "%s,%s,%s,%s", manufacturer, model,
+            (serial_number != NULL) ? serial_number : "",
+            (firmware_version != NULL) ? firmware_version : "");
+
+    return 0;
+}
@@ -31,6 +31,22 @@
 #ifndef MDNS_H
 #define MDNS_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <lxi.h>
+#include "txt.h"
+
+typedef struct
+{
+    void (*service)(void *userdata, lxi_event_t event, const char *address, const char *id, const char *service, int port);
+    bool (*cancelled)(void *userdata);
+    void *userdata;
+} mdns_watch_t;
+
 int mdns_discover(lxi_info_t *info, int timeout);
+int mdns_discover_if(lxi_info_t *info, const char *ifname, int timeout);
+int mdns_discover_txt(lxi_mdns_info_t *info, const char *ifname, lxi_family_t family, int timeout);
+int mdns_watch(mdns_watch_t *watch, int interval);
+int mdns_txt_id(const lxi_txt_t *txt, int count, char *id, size_t size);
 
 #endif
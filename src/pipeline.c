@@ -0,0 +1,416 @@
+/*
+ * Copyright (c) 2017-2022  Martin Lund
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <lxi.h>
+#include "pipeline.h"
+#include "transport.h"
+#include "vxi11.h"
+#include "mdns.h"
+#include "error.h"
+
+#define ID_LENGTH_MAX        1024
+#define RESPONSE_LENGTH_MAX  4096
+#define COMMAND_LENGTH_MAX   1024
+#define PIPELINE_WORKERS_MAX   16
+
+typedef enum
+{
+    PIPELINE_FOUND,      // Discovered, not matching filter (yet)
+    PIPELINE_QUEUED,     // Waiting for a worker to connect
+    PIPELINE_CONNECTING,
+    PIPELINE_DONE
+} pipeline_state_t;
+
+typedef struct
+{
+    char *address;
+    char *id;
+    pipeline_state_t state;
+    int device;
+    lxi_protocol_t protocol;
+} pipeline_device_t;
+
+typedef struct
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pipeline_device_t *devices;
+    int count;
+    int queued;
+    pthread_t workers[PIPELINE_WORKERS_MAX];
+    int worker_count;
+    int idle;
+    bool closing;
+    int timeout;
+    const char *match;
+    const char *init;
+} pipeline_t;
+
+// Pipeline of the discovery running in this thread, callbacks carry no context
+static __thread pipeline_t *pipeline_current = NULL;
+
+// Send initialization commands one per line, reading responses to queries
+static int pipeline_init(int device, const char *init, int timeout)
+{
+    char response[RESPONSE_LENGTH_MAX];
+    char *commands, *command, *save;
+    char message[COMMAND_LENGTH_MAX];
+    size_t length;
+    int status = 0;
+
+    commands = strdup(init);
+    if (commands == NULL)
+        return -1;
+
+    for (command = strtok_r(commands, "\n", &save); command != NULL; command = strtok_r(NULL, "\n", &save))
+    {
+        length = strlen(command);
+        if (length == 0)
+            continue;
+
+        if (length + 2 > sizeof(message))
+        {
+            error_printf("Initialization command too long\n");
+            status = -1;
+            break;
+        }
+        snprintf(message, sizeof(message), "%s\n", command);
+
+        if (lxi_send(device, message, length + 1, timeout) < 0)
+        {
+            status = -1;
+            break;
+        }
+
+        if ((command[length - 1] == '?') && (lxi_receive(device, response, sizeof(response), timeout) < 0))
+        {
+            status = -1;
+            break;
+        }
+    }
+
+    free(commands);
+
+    return status;
+}
+
+// Connect devices as they are queued, until discovery is over and queue is empty
+static void *thread_pipeline_worker(void *ptr)
+{
+    pipeline_t *pipeline = ptr;
+    lxi_transport_t transport;
+    char *address;
+    int device;
+    int i;
+
+    pthread_mutex_lock(&pipeline->mutex);
+
+    for (;;)
+    {
+        while ((pipeline->queued == 0) && !pipeline->closing)
+        {
+            pipeline->idle++;
+            pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+            pipeline->idle--;
+        }
+
+        if (pipeline->queued == 0)
+            break;
+
+        for (i = 0; pipeline->devices[i].state != PIPELINE_QUEUED; i++)
+            ;
+        pipeline->devices[i].state = PIPELINE_CONNECTING;
+        pipeline->queued--;
+
+        // Devices may be added and moved while connecting
+        address = strdup(pipeline->devices[i].address);
+        pthread_mutex_unlock(&pipeline->mutex);
+
+        device = LXI_ERROR;
+        memset(&transport, 0, sizeof(transport));
+        if (address != NULL)
+            device = transport_connect(address, NULL, pipeline->timeout, &transport);
+
+        if ((device >= 0) && (pipeline->init != NULL) && (pipeline_init(device, pipeline->init, pipeline->timeout) != 0))
+        {
+            error_printf("Failed to initialize %s\n", address);
+            lxi_disconnect(device);
+            device = LXI_ERROR;
+        }
+        free(address);
+
+        pthread_mutex_lock(&pipeline->mutex);
+        pipeline->devices[i].device = device;
+        pipeline->devices[i].protocol = transport.protocol;
+        pipeline->devices[i].state = PIPELINE_DONE;
+    }
+
+    pthread_mutex_unlock(&pipeline->mutex);
+
+    return NULL;
+}
+
+static pipeline_device_t *pipeline_device(pipeline_t *pipeline, const char *address)
+{
+    pipeline_device_t *devices;
+    pipeline_device_t *device;
+    int i;
+
+    for (i = 0; i < pipeline->count; i++)
+    {
+        if (strcmp(pipeline->devices[i].address, address) == 0)
+            return &pipeline->devices[i];
+    }
+
+    devices = realloc(pipeline->devices, (pipeline->count + 1) * sizeof(pipeline_device_t));
+    if (devices == NULL)
+        return NULL;
+    pipeline->devices = devices;
+
+    device = &pipeline->devices[pipeline->count];
+    memset(device, 0, sizeof(pipeline_device_t));
+    device->address = strdup(address);
+    if (device->address == NULL)
+        return NULL;
+    device->state = PIPELINE_FOUND;
+    device->device = LXI_ERROR;
+    pipeline->count++;
+
+    return device;
+}
+
+// Queue device for connecting as soon as it is known to match
+static void pipeline_found(const char *address, const char *id)
+{
+    pipeline_t *pipeline = pipeline_current;
+    pipeline_device_t *device;
+    char *id_new;
+
+    pthread_mutex_lock(&pipeline->mutex);
+
+    device = pipeline_device(pipeline, address);
+    if ((device == NULL) || (device->state != PIPELINE_FOUND))
+        goto unlock;
+
+    // Device may match by ID reported some other way later
+    if ((pipeline->match != NULL) && (fnmatch(pipeline->match, id, FNM_CASEFOLD) != 0))
+        goto unlock;
+
+    id_new = strdup(id);
+    if (id_new == NULL)
+        goto unlock;
+    free(device->id);
+    device->id = id_new;
+
+    device->state = PIPELINE_QUEUED;
+    pipeline->queued++;
+
+    // Connected in discovering thread at the end if no worker could be started
+    if ((pipeline->idle == 0) && (pipeline->worker_count < PIPELINE_WORKERS_MAX) &&
+        (pthread_create(&pipeline->workers[pipeline->worker_count], NULL, thread_pipeline_worker, pipeline) == 0))
+        pipeline->worker_count++;
+    else
+        pthread_cond_signal(&pipeline->cond);
+
+unlock:
+    pthread_mutex_unlock(&pipeline->mutex);
+}
+
+static void pipeline_device_found(const char *address, const char *id)
+{
+    pipeline_found(address, id);
+}
+
+static void pipeline_service_found(const char *address, const char *id, const char *service, int port,
+        const lxi_txt_t *txt, int txt_count)
+{
+    char device_id[ID_LENGTH_MAX];
+
+    // Identification announced by device is matched like the one reported via VXI-11
+    if (mdns_txt_id(txt, txt_count, device_id, sizeof(device_id)) == 0)
+        pipeline_found(address, device_id);
+    else
+        pipeline_found(address, id);
+}
+
+static void *thread_pipeline_mdns(void *ptr)
+{
+    pipeline_t *pipeline = (pipeline_t *) ptr;
+    lxi_mdns_info_t info = { .service = pipeline_service_found };
+
+    pipeline_current = pipeline;
+    mdns_discover_txt(&info, NULL, FAMILY_IPV4, pipeline->timeout);
+    pipeline_current = NULL;
+
+    return NULL;
+}
+
+static int pipeline_compare(const void *a, const void *b)
+{
+    const pipeline_device_t *device_a = a, *device_b = b;
+    struct in_addr addr_a, addr_b;
+
+    // Numeric order for IPv4 addresses
+    if ((inet_pton(AF_INET, device_a->address, &addr_a) == 1) &&
+        (inet_pton(AF_INET, device_b->address, &addr_b) == 1) &&
+        (addr_a.s_addr != addr_b.s_addr))
+        return (ntohl(addr_a.s_addr) < ntohl(addr_b.s_addr)) ? -1 : 1;
+
+    return strcmp(device_a->address, device_b->address);
+}
+
+// Pack connections and strings into one allocation owned by caller
+static lxi_connection_t *pipeline_pack(pipeline_t *pipeline, int count)
+{
+    lxi_connection_t *connections;
+    pipeline_device_t *device;
+    size_t string_total = 0;
+    char *pool;
+    int i, j = 0;
+
+    for (i = 0; i < pipeline->count; i++)
+    {
+        device = &pipeline->devices[i];
+        if (device->state == PIPELINE_DONE)
+            string_total += strlen(device->address) + 1 + strlen(device->id) + 1;
+    }
+
+    connections = malloc(count * sizeof(lxi_connection_t) + string_total);
+    if (connections == NULL)
+        return NULL;
+
+    pool = (char *) (connections + count);
+
+    for (i = 0; i < pipeline->count; i++)
+    {
+        device = &pipeline->devices[i];
+        if (device->state != PIPELINE_DONE)
+            continue;
+
+        connections[j].address = strcpy(pool, device->address);
+        pool += strlen(pool) + 1;
+        connections[j].id = strcpy(pool, device->id);
+        pool += strlen(pool) + 1;
+        connections[j].device = device->device;
+        connections[j].protocol = device->protocol;
+        j++;
+    }
+
+    return connections;
+}
+
+int pipeline_connect(lxi_connection_t **connections, int timeout, lxi_discover_t type,
+        const char *match, const char *init)
+{
+    lxi_info_t info = { .broadcast = NULL, .device = pipeline_device_found, .service = NULL };
+    pipeline_t pipeline;
+    pthread_t thread;
+    bool mdns_thread = false;
+    int count = 0;
+    int i;
+
+    memset(&pipeline, 0, sizeof(pipeline));
+    pthread_mutex_init(&pipeline.mutex, NULL);
+    pthread_cond_init(&pipeline.cond, NULL);
+    pipeline.timeout = timeout;
+    pipeline.match = match;
+    pipeline.init = init;
+
+    // Search via mDNS alongside VXI-11 broadcast when looking for both
+    if ((type == DISCOVER_MDNS) || (type == DISCOVER_ALL))
+    {
+        if (pthread_create(&thread, NULL, thread_pipeline_mdns, &pipeline) == 0)
+            mdns_thread = true;
+        else
+            thread_pipeline_mdns(&pipeline);
+    }
+
+    if ((type == DISCOVER_VXI11) || (type == DISCOVER_ALL))
+    {
+        pipeline_current = &pipeline;
+        vxi11_discover(&info, timeout);
+        pipeline_current = NULL;
+    }
+
+    if (mdns_thread)
+        pthread_join(thread, NULL);
+
+    // Help connecting devices still queued, then wait for workers to finish
+    pthread_mutex_lock(&pipeline.mutex);
+    pipeline.closing = true;
+    pthread_cond_broadcast(&pipeline.cond);
+    pthread_mutex_unlock(&pipeline.mutex);
+
+    thread_pipeline_worker(&pipeline);
+    for (i = 0; i < pipeline.worker_count; i++)
+        pthread_join(pipeline.workers[i], NULL);
+
+    *connections = NULL;
+
+    for (i = 0; i < pipeline.count; i++)
+    {
+        if (pipeline.devices[i].state == PIPELINE_DONE)
+            count++;
+    }
+
+    if (count > 0)
+    {
+        qsort(pipeline.devices, pipeline.count, sizeof(pipeline_device_t), pipeline_compare);
+        *connections = pipeline_pack(&pipeline, count);
+        if (*connections == NULL)
+        {
+            // Handles would be lost otherwise
+            for (i = 0; i < pipeline.count; i++)
+            {
+                if (pipeline.devices[i].device >= 0)
+                    lxi_disconnect(pipeline.devices[i].device);
+            }
+            count = -1;
+        }
+    }
+
+    for (i = 0; i < pipeline.count; i++)
+    {
+        free(pipeline.devices[i].address);
+        free(pipeline.devices[i].id);
+    }
+    free(pipeline.devices);
+    pthread_cond_destroy(&pipeline.cond);
+    pthread_mutex_destroy(&pipeline.mutex);
+
+    return count;
+}
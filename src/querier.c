@@ -0,0 +1,1016 @@
+/*
+ * Copyright (c) 2017-2022  Martin Lund
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <lxi.h>
+#include "mdns.h"
+#include "querier.h"
+#include "until.h"
+#include "error.h"
+
+#define MDNS_PORT              5353
+#define MDNS_GROUP_IPV4 "224.0.0.251"
+#define MDNS_GROUP_IPV6     "ff02::fb"
+#define NAME_LENGTH_MAX         256 // Uncompressed name in wire format
+#define LABEL_LENGTH_MAX         63
+#define POINTERS_MAX             16 // Compression pointers followed per name
+#define PACKET_LENGTH_MAX      9000 // Largest mDNS packet
+#define QUERY_LENGTH_MAX       1440 // Query fits unfragmented in any Ethernet frame
+#define HEADER_LENGTH            12
+#define FLAG_RESPONSE        0x8000
+#define CLASS_MASK           0x7fff // Without cache flush bit
+#define CLASS_IN                  1
+#define TYPE_A                    1
+#define TYPE_PTR                 12
+#define TYPE_TXT                 16
+#define TYPE_AAAA                28
+#define TYPE_SRV                 33
+#define QUERY_INTERVAL         1000 // First repeat, doubled after each (RFC 6762, 5.2)
+#define RESOLVE_DELAY           100 // Time for remaining answers to arrive before asking for them
+#define INTERFACES_MAX           32
+#define SERVICE_TYPES_MAX         8
+
+typedef struct
+{
+    uint8_t data[NAME_LENGTH_MAX];
+    int length;
+} dns_name_t;
+
+typedef struct querier_host
+{
+    dns_name_t name;
+    bool have_ipv4;
+    struct in_addr ipv4;
+    bool have_ipv6;
+    struct in6_addr ipv6;
+    unsigned int ipv6_interface;
+    struct querier_host *next;
+} querier_host_t;
+
+typedef struct querier_service
+{
+    int type;
+    dns_name_t instance;
+    uint32_t ttl;
+    long long received;
+    bool have_srv;
+    dns_name_t target;
+    uint16_t port;
+    bool have_txt;
+    uint8_t *txt;
+    uint16_t txt_length;
+    bool reported_ipv4;
+    bool reported_ipv6;
+    struct querier_service *next;
+} querier_service_t;
+
+typedef struct
+{
+    unsigned int index;
+    struct in_addr address;
+} querier_interface_t;
+
+typedef struct
+{
+    lxi_info_t *info;
+    lxi_mdns_info_t *mdns_info;
+    unsigned int interface;
+    lxi_family_t family;
+    dns_name_t types[SERVICE_TYPES_MAX];
+    int type_count;
+    int sockets[2];
+    querier_interface_t interfaces[2][INTERFACES_MAX];
+    int interface_count[2];
+    querier_service_t *services;
+    querier_host_t *hosts;
+    bool incomplete;
+} querier_t;
+
+enum { SOCKET_IPV4, SOCKET_IPV6 };
+
+static long long time_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint16_t read_u16(const uint8_t *data)
+{
+    return (uint16_t) ((data[0] << 8) | data[1]);
+}
+
+static uint32_t read_u32(const uint8_t *data)
+{
+    return ((uint32_t) data[0] << 24) | ((uint32_t) data[1] << 16) | ((uint32_t) data[2] << 8) | data[3];
+}
+
+static void write_u16(uint8_t *data, uint16_t value)
+{
+    data[0] = value >> 8;
+    data[1] = value & 0xff;
+}
+
+static void write_u32(uint8_t *data, uint32_t value)
+{
+    write_u16(data, value >> 16);
+    write_u16(data + 2, value & 0xffff);
+}
+
+// Name in wire format from dotted string without escapes, e.g. "_lxi._tcp.local"
+static int name_from_string(dns_name_t *name, const char *string)
+{
+    const char *label = string;
+    const char *dot;
+    size_t length;
+
+    name->length = 0;
+
+    while (*label != 0)
+    {
+        dot = strchr(label, '.');
+        length = (dot != NULL) ? (size_t) (dot - label) : strlen(label);
+
+        if ((length == 0) || (length > LABEL_LENGTH_MAX) || (name->length + length + 2 > NAME_LENGTH_MAX))
+            return -1;
+
+        name->data[name->length++] = length;
+        memcpy(name->data + name->length, label, length);
+        name->length += length;
+
+        label += length;
+        if (*label == '.')
+            label++;
+    }
+
+    name->data[name->length++] = 0;
+
+    return 0;
+}
+
+// Names are compared case-insensitively, length octets are never letters
+static bool name_equal(const dns_name_t *a, const dns_name_t *b)
+{
+    int i;
+
+    if (a->length != b->length)
+        return false;
+
+    for (i = 0; i < a->length; i++)
+    {
+        uint8_t x = a->data[i], y = b->data[i];
+
+        if ((x >= 'A') && (x <= 'Z'))
+            x += 'a' - 'A';
+        if ((y >= 'A') && (y <= 'Z'))
+            y += 'a' - 'A';
+        if (x != y)
+            return false;
+    }
+
+    return true;
+}
+
+// Read possibly compressed name, offset is advanced past name where it is stored
+static int name_read(const uint8_t *packet, size_t length, size_t *offset, dns_name_t *name)
+{
+    size_t position = *offset;
+    bool jumped = false;
+    int pointers = 0;
+    uint8_t label;
+
+    name->length = 0;
+
+    for (;;)
+    {
+        if (position >= length)
+            return -1;
+
+        label = packet[position];
+
+        // Compression pointer to earlier name
+        if ((label & 0xc0) == 0xc0)
+        {
+            if ((position + 1 >= length) || (++pointers > POINTERS_MAX))
+                return -1;
+            if (!jumped)
+                *offset = position + 2;
+            jumped = true;
+            position = ((label & 0x3f) << 8) | packet[position + 1];
+            continue;
+        }
+
+        if (label > LABEL_LENGTH_MAX)
+            return -1;
+
+        if ((position + 1 + label > length) || (name->length + 1 + label > NAME_LENGTH_MAX))
+            return -1;
+
+        memcpy(name->data + name->length, packet + position, 1 + label);
+        name->length += 1 + label;
+        position += 1 + label;
+
+        if (label == 0)
+            break;
+    }
+
+    if (!jumped)
+        *offset = position;
+
+    return 0;
+}
+
+// First label of service instance name is its human readable name
+static void name_label(const dns_name_t *name, char *string, size_t size)
+{
+    size_t length = name->data[0];
+
+    if (length >= size)
+        length = size - 1;
+
+    memcpy(string, name->data + 1, length);
+    string[length] = 0;
+}
+
+static int service_type(querier_t *querier, const dns_name_t *name)
+{
+    int i;
+
+    for (i = 0; i < querier->type_count; i++)
+    {
+        if (name_equal(&querier->types[i], name))
+            return i;
+    }
+
+    return -1;
+}
+
+static querier_service_t *service_find(querier_t *querier, const dns_name_t *instance)
+{
+    querier_service_t *service;
+
+    for (service = querier->services; service != NULL; service = service->next)
+    {
+        if (name_equal(&service->instance, instance))
+            return service;
+    }
+
+    return NULL;
+}
+
+static querier_host_t *host_find(querier_t *querier, const dns_name_t *name)
+{
+    querier_host_t *host;
+
+    for (host = querier->hosts; host != NULL; host = host->next)
+    {
+        if (name_equal(&host->name, name))
+            return host;
+    }
+
+    return NULL;
+}
+
+static bool family_wanted(querier_t *querier, int family)
+{
+    return (querier->family == FAMILY_ANY) || ((querier->family == FAMILY_IPV6) == (family == AF_INET6));
+}
+
+static void record_ptr(querier_t *querier, const uint8_t *packet, size_t length, const dns_name_t *owner,
+        uint32_t ttl, size_t rdata, long long now)
+{
+    querier_service_t *service;
+    dns_name_t instance;
+    int type;
+
+    type = service_type(querier, owner);
+    if (type < 0)
+        return;
+
+    if (name_read(packet, length, &rdata, &instance) != 0)
+        return;
+
+    // Goodbye of service not seen before is of no interest
+    service = service_find(querier, &instance);
+    if (service == NULL)
+    {
+        if (ttl == 0)
+            return;
+
+        service = calloc(1, sizeof(querier_service_t));
+        if (service == NULL)
+            return;
+        service->type = type;
+        service->instance = instance;
+        service->next = querier->services;
+        querier->services = service;
+    }
+
+    service->ttl = ttl;
+    service->received = now;
+}
+
+static void record_srv(querier_t *querier, const uint8_t *packet, size_t length, const dns_name_t *owner,
+        size_t rdata, uint16_t rdlength)
+{
+    querier_service_t *service;
+    querier_host_t *host;
+    dns_name_t target;
+
+    service = service_find(querier, owner);
+    if ((service == NULL) || (rdlength < 7))
+        return;
+
+    // Priority and weight are of no use to a single lookup
+    service->port = read_u16(packet + rdata + 4);
+    rdata += 6;
+    if (name_read(packet, length, &rdata, &target) != 0)
+        return;
+
+    service->target = target;
+    service->have_srv = true;
+
+    if (host_find(querier, &target) != NULL)
+        return;
+
+    host = calloc(1, sizeof(querier_host_t));
+    if (host == NULL)
+        return;
+    host->name = target;
+    host->next = querier->hosts;
+    querier->hosts = host;
+}
+
+static void record_txt(querier_t *querier, const uint8_t *packet, const dns_name_t *owner,
+        size_t rdata, uint16_t rdlength)
+{
+    querier_service_t *service;
+    uint8_t *txt;
+
+    service = service_find(querier, owner);
+    if (service == NULL)
+        return;
+
+    txt = malloc(rdlength + 1);
+    if (txt == NULL)
+        return;
+    memcpy(txt, packet + rdata, rdlength);
+
+    free(service->txt);
+    service->txt = txt;
+    service->txt_length = rdlength;
+    service->have_txt = true;
+}
+
+static void record_address(querier_t *querier, const uint8_t *packet, const dns_name_t *owner, uint16_t type,
+        size_t rdata, uint16_t rdlength, unsigned int interface)
+{
+    querier_host_t *host;
+
+    host = host_find(querier, owner);
+    if (host == NULL)
+        return;
+
+    if ((type == TYPE_A) && (rdlength == 4))
+    {
+        memcpy(&host->ipv4, packet + rdata, 4);
+        host->have_ipv4 = true;
+    }
+    else if ((type == TYPE_AAAA) && (rdlength == 16))
+    {
+        memcpy(&host->ipv6, packet + rdata, 16);
+        host->ipv6_interface = interface;
+        host->have_ipv6 = true;
+    }
+}
+
+// Go through records of all sections, services first so their host records can be matched
+static void querier_parse(querier_t *querier, const uint8_t *packet, size_t length, unsigned int interface, long long now)
+{
+    uint16_t questions, records;
+    uint16_t type, rdlength;
+    uint32_t ttl;
+    size_t offset, rdata;
+    dns_name_t owner;
+    int pass;
+    int i;
+
+    if ((length < HEADER_LENGTH) || !(read_u16(packet + 2) & FLAG_RESPONSE))
+        return;
+
+    questions = read_u16(packet + 4);
+    records = read_u16(packet + 6) + read_u16(packet + 8) + read_u16(packet + 10);
+
+    for (pass = 0; pass < 3; pass++)
+    {
+        offset = HEADER_LENGTH;
+
+        for (i = 0; i < questions; i++)
+        {
+            if ((name_read(packet, length, &offset, &owner) != 0) || (offset + 4 > length))
+                return;
+            offset += 4;
+        }
+
+        for (i = 0; i < records; i++)
+        {
+            if ((name_read(packet, length, &offset, &owner) != 0) || (offset + 10 > length))
+                return;
+
+            type = read_u16(packet + offset);
+            ttl = read_u32(packet + offset + 4);
+            rdlength = read_u16(packet + offset + 8);
+            rdata = offset + 10;
+            if (rdata + rdlength > length)
+                return;
+            offset = rdata + rdlength;
+
+            if ((read_u16(packet + rdata - 8) & CLASS_MASK) != CLASS_IN)
+                continue;
+
+            if ((pass == 0) && (type == TYPE_PTR))
+                record_ptr(querier, packet, rdata + rdlength, &owner, ttl, rdata, now);
+            else if ((pass == 1) && (type == TYPE_SRV))
+                record_srv(querier, packet, rdata + rdlength, &owner, rdata, rdlength);
+            else if ((pass == 1) && (type == TYPE_TXT))
+                record_txt(querier, packet, &owner, rdata, rdlength);
+            else if ((pass == 2) && ((type == TYPE_A) || (type == TYPE_AAAA)))
+                record_address(querier, packet, &owner, type, rdata, rdlength, interface);
+        }
+    }
+}
+
+static void address_print(querier_host_t *host, int family, char *buffer, size_t size)
+{
+    char ifname[IF_NAMESIZE];
+    size_t length;
+
+    if (family == AF_INET)
+    {
+        inet_ntop(AF_INET, &host->ipv4, buffer, size);
+        return;
+    }
+
+    inet_ntop(AF_INET6, &host->ipv6, buffer, size);
+
+    // Link-local IPv6 address is only usable along with its interface
+    if (IN6_IS_ADDR_LINKLOCAL(&host->ipv6) && (if_indextoname(host->ipv6_interface, ifname) != NULL))
+    {
+        length = strlen(buffer);
+        snprintf(buffer + length, size - length, "%%%s", ifname);
+    }
+}
+
+static void service_report(querier_t *querier, querier_service_t *service, querier_host_t *host, int family)
+{
+    char address[INET6_ADDRSTRLEN + IF_NAMESIZE + 1];
+    char name[LABEL_LENGTH_MAX + 1];
+    const char *type = lxi_services[service->type].service_name;
+    mdns_txt_t txt;
+
+    address_print(host, family, address, sizeof(address));
+    name_label(&service->instance, name, sizeof(name));
+
+    if (querier->info != NULL)
+    {
+        if (querier->info->service != NULL)
+            querier->info->service(address, name, type, service->port);
+        return;
+    }
+
+    if (querier->mdns_info->service == NULL)
+        return;
+
+    memset(&txt, 0, sizeof(txt));
+    if (service->have_txt)
+        mdns_txt_parse(&txt, service->txt, service->txt_length);
+
+    querier->mdns_info->service(address, name, type, service->port, txt.items, txt.count);
+    mdns_txt_free(&txt);
+}
+
+// Report services once per address family as soon as everything needed has been received
+static void querier_report(querier_t *querier, bool deadline)
+{
+    querier_service_t *service;
+    querier_host_t *host;
+
+    querier->incomplete = false;
+
+    // Nothing more to report once caller has found what it looks for
+    if (until_reached())
+        return;
+
+    for (service = querier->services; service != NULL; service = service->next)
+    {
+        // Service withdrawn by goodbye packet
+        if (service->ttl == 0)
+            continue;
+
+        host = service->have_srv ? host_find(querier, &service->target) : NULL;
+
+        // TXT record only matters when it is to be reported
+        if ((host == NULL) || (!service->have_txt && (querier->mdns_info != NULL) && !deadline) ||
+            (!host->have_ipv4 && family_wanted(querier, AF_INET)) ||
+            (!host->have_ipv6 && family_wanted(querier, AF_INET6)))
+            querier->incomplete = true;
+
+        if (host == NULL)
+            continue;
+        if (!service->have_txt && (querier->mdns_info != NULL) && !deadline)
+            continue;
+
+        if (until_reached())
+            break;
+
+        if (host->have_ipv4 && !service->reported_ipv4 && family_wanted(querier, AF_INET))
+        {
+            service_report(querier, service, host, AF_INET);
+            service->reported_ipv4 = true;
+        }
+
+        if (host->have_ipv6 && !service->reported_ipv6 && family_wanted(querier, AF_INET6) && !until_reached())
+        {
+            service_report(querier, service, host, AF_INET6);
+            service->reported_ipv6 = true;
+        }
+    }
+}
+
+static size_t question_add(uint8_t *packet, size_t offset, const dns_name_t *name, uint16_t type)
+{
+    if (offset + name->length + 4 > QUERY_LENGTH_MAX)
+        return 0;
+
+    memcpy(packet + offset, name->data, name->length);
+    offset += name->length;
+    write_u16(packet + offset, type);
+    write_u16(packet + offset + 2, CLASS_IN);
+
+    return offset + 4;
+}
+
+// Build query for all service types, asking directly for records still missing
+static size_t query_build(querier_t *querier, uint8_t *packet, long long now)
+{
+    querier_service_t *service;
+    querier_host_t *host;
+    uint16_t questions = 0, answers = 0;
+    size_t offset = HEADER_LENGTH;
+    size_t next;
+    uint32_t elapsed, remaining;
+    int i;
+
+    memset(packet, 0, HEADER_LENGTH);
+
+    for (i = 0; i < querier->type_count; i++)
+    {
+        offset = question_add(packet, offset, &querier->types[i], TYPE_PTR);
+        questions++;
+    }
+
+    for (service = querier->services; service != NULL; service = service->next)
+    {
+        if (service->ttl == 0)
+            continue;
+
+        if (!service->have_srv && ((next = question_add(packet, offset, &service->instance, TYPE_SRV)) != 0))
+        {
+            offset = next;
+            questions++;
+        }
+
+        if (!service->have_txt && (querier->mdns_info != NULL) &&
+            ((next = question_add(packet, offset, &service->instance, TYPE_TXT)) != 0))
+        {
+            offset = next;
+            questions++;
+        }
+    }
+
+    for (host = querier->hosts; host != NULL; host = host->next)
+    {
+        if (!host->have_ipv4 && family_wanted(querier, AF_INET) &&
+            ((next = question_add(packet, offset, &host->name, TYPE_A)) != 0))
+        {
+            offset = next;
+            questions++;
+        }
+
+        if (!host->have_ipv6 && family_wanted(querier, AF_INET6) &&
+            ((next = question_add(packet, offset, &host->name, TYPE_AAAA)) != 0))
+        {
+            offset = next;
+            questions++;
+        }
+    }
+
+    // Known answers still valid for more than half their lifetime need not be repeated (RFC 6762, 7.1)
+    for (service = querier->services; service != NULL; service = service->next)
+    {
+        elapsed = (uint32_t) ((now - service->received) / 1000);
+        if (service->ttl <= elapsed)
+            continue;
+        remaining = service->ttl - elapsed;
+        if (remaining <= service->ttl / 2)
+            continue;
+
+        next = offset + querier->types[service->type].length + 10 + service->instance.length;
+        if (next > QUERY_LENGTH_MAX)
+            break;
+
+        memcpy(packet + offset, querier->types[service->type].data, querier->types[service->type].length);
+        offset += querier->types[service->type].length;
+        write_u16(packet + offset, TYPE_PTR);
+        write_u16(packet + offset + 2, CLASS_IN);
+        write_u32(packet + offset + 4, remaining);
+        write_u16(packet + offset + 8, service->instance.length);
+        memcpy(packet + offset + 10, service->instance.data, service->instance.length);
+        offset = next;
+        answers++;
+    }
+
+    write_u16(packet + 4, questions);
+    write_u16(packet + 6, answers);
+
+    return offset;
+}
+
+// Collect multicast capable interfaces to send queries on
+static void querier_interfaces(querier_t *querier)
+{
+    struct ifaddrs *ifaddrs, *ifa;
+    querier_interface_t *interface;
+    unsigned int index;
+    int family, i, j;
+
+    if (getifaddrs(&ifaddrs) != 0)
+        return;
+
+    for (ifa = ifaddrs; ifa != NULL; ifa = ifa->ifa_next)
+    {
+        if ((ifa->ifa_addr == NULL) || !(ifa->ifa_flags & IFF_UP) || !(ifa->ifa_flags & IFF_MULTICAST))
+            continue;
+
+        family = ifa->ifa_addr->sa_family;
+        if ((family != AF_INET) && (family != AF_INET6))
+            continue;
+
+        i = (family == AF_INET) ? SOCKET_IPV4 : SOCKET_IPV6;
+        if (querier->sockets[i] < 0)
+            continue;
+
+        index = if_nametoindex(ifa->ifa_name);
+        if ((index == 0) || ((querier->interface != 0) && (index != querier->interface)))
+            continue;
+
+        // Interface may have several addresses, one query per interface is enough
+        for (j = 0; j < querier->interface_count[i]; j++)
+        {
+            if (querier->interfaces[i][j].index == index)
+                break;
+        }
+        if ((j < querier->interface_count[i]) || (j == INTERFACES_MAX))
+            continue;
+
+        interface = &querier->interfaces[i][querier->interface_count[i]++];
+        interface->index = index;
+        if (family == AF_INET)
+            interface->address = ((struct sockaddr_in *) ifa->ifa_addr)->sin_addr;
+    }
+
+    freeifaddrs(ifaddrs);
+}
+
+static int querier_open(int family)
+{
+    struct sockaddr_storage address;
+    socklen_t length;
+    int fd;
+    int ttl = 255;
+    int on = 1;
+
+    fd = socket(family, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+    if (fd < 0)
+        return -1;
+
+    // Ephemeral source port makes this a one-shot query, answered by unicast (RFC 6762, 5.1)
+    memset(&address, 0, sizeof(address));
+    address.ss_family = family;
+    length = (family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+
+    if (family == AF_INET)
+    {
+        setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+        setsockopt(fd, IPPROTO_IP, IP_PKTINFO, &on, sizeof(on));
+    }
+    else
+    {
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on));
+        setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &ttl, sizeof(ttl));
+        setsockopt(fd, IPPROTO_IPV6, IPV6_RECVPKTINFO, &on, sizeof(on));
+    }
+
+    if (bind(fd, (struct sockaddr *) &address, length) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void querier_send(querier_t *querier, long long now)
+{
+    uint8_t packet[QUERY_LENGTH_MAX];
+    struct sockaddr_in ipv4;
+    struct sockaddr_in6 ipv6;
+    querier_interface_t *interface;
+    size_t length;
+    int i;
+
+    length = query_build(querier, packet, now);
+
+    memset(&ipv4, 0, sizeof(ipv4));
+    ipv4.sin_family = AF_INET;
+    ipv4.sin_port = htons(MDNS_PORT);
+    inet_pton(AF_INET, MDNS_GROUP_IPV4, &ipv4.sin_addr);
+
+    memset(&ipv6, 0, sizeof(ipv6));
+    ipv6.sin6_family = AF_INET6;
+    ipv6.sin6_port = htons(MDNS_PORT);
+    inet_pton(AF_INET6, MDNS_GROUP_IPV6, &ipv6.sin6_addr);
+
+    for (i = 0; i < querier->interface_count[SOCKET_IPV4]; i++)
+    {
+        interface = &querier->interfaces[SOCKET_IPV4][i];
+        setsockopt(querier->sockets[SOCKET_IPV4], IPPROTO_IP, IP_MULTICAST_IF, &interface->address,
+                sizeof(interface->address));
+        sendto(querier->sockets[SOCKET_IPV4], packet, length, 0, (struct sockaddr *) &ipv4, sizeof(ipv4));
+    }
+
+    for (i = 0; i < querier->interface_count[SOCKET_IPV6]; i++)
+    {
+        interface = &querier->interfaces[SOCKET_IPV6][i];
+        setsockopt(querier->sockets[SOCKET_IPV6], IPPROTO_IPV6, IPV6_MULTICAST_IF, &interface->index,
+                sizeof(interface->index));
+        ipv6.sin6_scope_id = interface->index;
+        sendto(querier->sockets[SOCKET_IPV6], packet, length, 0, (struct sockaddr *) &ipv6, sizeof(ipv6));
+    }
+}
+
+static void querier_receive(querier_t *querier, int fd, long long now)
+{
+    uint8_t packet[PACKET_LENGTH_MAX];
+    uint8_t control[256];
+    struct sockaddr_storage source;
+    struct msghdr message;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    unsigned int interface = 0;
+    uint16_t port;
+    ssize_t length;
+
+    memset(&message, 0, sizeof(message));
+    iov.iov_base = packet;
+    iov.iov_len = sizeof(packet);
+    message.msg_name = &source;
+    message.msg_namelen = sizeof(source);
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    length = recvmsg(fd, &message, 0);
+    if (length <= 0)
+        return;
+
+    for (cmsg = CMSG_FIRSTHDR(&message); cmsg != NULL; cmsg = CMSG_NXTHDR(&message, cmsg))
+    {
+        if ((cmsg->cmsg_level == IPPROTO_IP) && (cmsg->cmsg_type == IP_PKTINFO))
+            interface = ((struct in_pktinfo *) CMSG_DATA(cmsg))->ipi_ifindex;
+        else if ((cmsg->cmsg_level == IPPROTO_IPV6) && (cmsg->cmsg_type == IPV6_PKTINFO))
+            interface = ((struct in6_pktinfo *) CMSG_DATA(cmsg))->ipi6_ifindex;
+    }
+
+    // Responses not coming from an mDNS responder are not to be trusted (RFC 6762, 6)
+    if (source.ss_family == AF_INET)
+        port = ntohs(((struct sockaddr_in *) &source)->sin_port);
+    else
+        port = ntohs(((struct sockaddr_in6 *) &source)->sin6_port);
+    if (port != MDNS_PORT)
+        return;
+
+    if ((querier->interface != 0) && (interface != querier->interface))
+        return;
+
+    querier_parse(querier, packet, length, interface, now);
+}
+
+static void querier_free(querier_t *querier)
+{
+    querier_service_t *service;
+    querier_host_t *host;
+    int i;
+
+    while (querier->services != NULL)
+    {
+        service = querier->services;
+        querier->services = service->next;
+        free(service->txt);
+        free(service);
+    }
+
+    while (querier->hosts != NULL)
+    {
+        host = querier->hosts;
+        querier->hosts = host->next;
+        free(host);
+    }
+
+    for (i = 0; i < 2; i++)
+    {
+        if (querier->sockets[i] >= 0)
+            close(querier->sockets[i]);
+    }
+}
+
+static int querier_run(querier_t *querier, int timeout)
+{
+    struct pollfd fds[2];
+    long long now, deadline, next_query, next_resolve = -1;
+    long long wait;
+    char type[NAME_LENGTH_MAX];
+    int interval = QUERY_INTERVAL;
+    int count = 0;
+    int i;
+
+    for (i = 0; (lxi_services[i].broadcast_type != NULL) && (i < SERVICE_TYPES_MAX); i++)
+    {
+        snprintf(type, sizeof(type), "%slocal", lxi_services[i].broadcast_type);
+        if (name_from_string(&querier->types[querier->type_count], type) == 0)
+            querier->type_count++;
+    }
+
+    querier->sockets[SOCKET_IPV4] = -1;
+    querier->sockets[SOCKET_IPV6] = -1;
+    if (querier->family != FAMILY_IPV6)
+        querier->sockets[SOCKET_IPV4] = querier_open(AF_INET);
+    if (querier->family != FAMILY_IPV4)
+        querier->sockets[SOCKET_IPV6] = querier_open(AF_INET6);
+
+    if ((querier->sockets[SOCKET_IPV4] < 0) && (querier->sockets[SOCKET_IPV6] < 0))
+    {
+        error_printf("Could not open mDNS socket (%s)\n", strerror(errno));
+        return -1;
+    }
+
+    querier_interfaces(querier);
+
+    now = time_ms();
+    deadline = now + timeout;
+    next_query = now;
+
+    for (i = 0; i < 2; i++)
+    {
+        if (querier->sockets[i] >= 0)
+            fds[count++].fd = querier->sockets[i];
+    }
+
+    while ((now < deadline) && !until_reached())
+    {
+        if (now >= next_query)
+        {
+            // Nothing left to resolve by first repeat means all responders have answered
+            if ((interval > QUERY_INTERVAL) && !querier->incomplete)
+            {
+                until_settled();
+                if (until_reached())
+                    break;
+            }
+
+            querier_send(querier, now);
+            next_query = now + interval;
+            interval *= 2;
+            next_resolve = -1;
+        }
+        else if ((next_resolve >= 0) && (now >= next_resolve))
+        {
+            querier_send(querier, now);
+            next_resolve = -1;
+        }
+
+        wait = next_query;
+        if ((next_resolve >= 0) && (next_resolve < wait))
+            wait = next_resolve;
+        if (deadline < wait)
+            wait = deadline;
+
+        for (i = 0; i < count; i++)
+        {
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+        }
+
+        if (poll(fds, count, wait - now) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        now = time_ms();
+
+        for (i = 0; i < count; i++)
+        {
+            if (fds[i].revents & POLLIN)
+            {
+                querier_receive(querier, fds[i].fd, now);
+
+                // Answers may be split across packets, ask for the rest if they are not coming
+                querier_report(querier, false);
+                if (querier->incomplete && (next_resolve < 0))
+                    next_resolve = now + RESOLVE_DELAY;
+            }
+        }
+    }
+
+    // Report what could be resolved, even if announced without TXT record
+    querier_report(querier, true);
+
+    return 0;
+}
+
+int querier_discover(lxi_info_t *info, unsigned int interface, int timeout)
+{
+    querier_t querier;
+    int status;
+
+    memset(&querier, 0, sizeof(querier));
+    querier.info = info;
+    querier.interface = interface;
+    querier.family = FAMILY_IPV4;
+
+    status = querier_run(&querier, timeout);
+    querier_free(&querier);
+
+    return status;
+}
+
+int querier_discover_txt(lxi_mdns_info_t *info, unsigned int interface, lxi_family_t family, int timeout)
+{
+    querier_t querier;
+    int status;
+
+    memset(&querier, 0, sizeof(querier));
+    querier.mdns_info = info;
+    querier.interface = interface;
+    querier.family = family;
+
+    status = querier_run(&querier, timeout);
+    querier_free(&querier);
+
+    return status;
+}
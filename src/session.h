@@ -32,6 +32,7 @@
 #define SESSION_H
 
 #include <stdbool.h>
+#include <time.h>
 #include <lxi.h>
 
 #define SESSIONS_MAX 1024
@@ -45,6 +46,31 @@ struct session_t
     int (*disconnect)(void *data);
     int (*send)(void *data, const char *message, int length, int timeout);
     int (*receive)(void *data, char *message, int length, int timeout);
+    int (*send_query)(void *data, const char *message, int length, unsigned int *id, int timeout);
+    int (*receive_response)(void *data, unsigned int id, char *message, int length, int timeout);
+    int (*set_overlapped)(void *data, bool enable, int timeout);
+    int (*set_termchar)(void *data, int termchar);
+    int (*abort)(void *data);
+    int (*read_stb)(void *data, int timeout);
+    int (*trigger)(void *data, int timeout, long long *sent);
+    int (*clear)(void *data, int timeout);
+    int (*remote)(void *data, int timeout);
+    int (*local)(void *data, int timeout);
+    int (*lock)(void *data, int timeout);
+    int (*lock_shared)(void *data, const char *name, int timeout);
+    int (*unlock)(void *data);
+    int (*enable_srq)(void *data, int handle, void (*handler)(int handle));
+    void (*srq_callback)(int device);
 };
 
+// Monotonic time in nanoseconds, taken by backends right before a trigger request goes out
+static inline long long session_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
 #endif
@@ -39,6 +39,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include "tcp.h"
+#include "session.h"
 #include "error.h"
 #include <fcntl.h>
 
@@ -163,6 +164,12 @@ int tcp_connect(void *data, const char *address, int port, const char *name, int
         close(tcp_data->server_socket);
         return -1;
       }
+      if (opt != 0)
+      {
+        error_printf("connect() call failed (%s)\n", strerror(opt));
+        close(tcp_data->server_socket);
+        return -1;
+      }
     }
 
     return 0;
@@ -205,7 +212,7 @@ int tcp_send(void *data, const char *message, int length, int timeout)
         // Send until all data is sent
         do
         {
-            n = send(tcp_data->server_socket, message + n, length, 0);
+            n = send(tcp_data->server_socket, message + n, length, MSG_NOSIGNAL);
             if (n < 0)
             {
                 error_printf("%s\n", strerror(errno));
@@ -279,3 +286,44 @@ int tcp_receive_wait(void *data, char *message, int length, int timeout)
 {
     return tcp_receive_(data, message, length, timeout, 0);
 }
+
+int tcp_read_stb(void *data, int timeout)
+{
+    char *request = "*STB?\n";
+    char response[32];
+    char *end;
+    long stb;
+    int length;
+
+    // Raw sockets have no status byte service so query it via SCPI
+    if (tcp_send(data, request, strlen(request), timeout) < 0)
+        return -1;
+
+    length = tcp_receive(data, response, sizeof(response) - 1, timeout);
+    if (length <= 0)
+        return -1;
+    response[length] = 0;
+
+    stb = strtol(response, &end, 10);
+    if ((end == response) || (stb < 0) || (stb > 255))
+    {
+        error_printf("Invalid status byte response\n");
+        return -1;
+    }
+
+    return (int) stb;
+}
+
+int tcp_trigger(void *data, int timeout, long long *sent)
+{
+    char *request = "*TRG\n";
+
+    if (sent != NULL)
+        *sent = session_time_ns();
+
+    // Raw sockets have no trigger service so trigger via SCPI
+    if (tcp_send(data, request, strlen(request), timeout) < 0)
+        return -1;
+
+    return 0;
+}
@@ -41,5 +41,7 @@ int tcp_disconnect(void *data);
 int tcp_send(void *data, const char *message, int length, int timeout);
 int tcp_receive(void *data, char *message, int length, int timeout);
 int tcp_receive_wait(void *data, char *message, int length, int timeout);
+int tcp_read_stb(void *data, int timeout);
+int tcp_trigger(void *data, int timeout, long long *sent);
 
 #endif
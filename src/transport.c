@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2017-2022  Martin Lund
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <lxi.h>
+#include "transport.h"
+#include "error.h"
+
+#define PORT_RAW               5025
+#define PORT_HISLIP            4880
+#define ID_REQ_SCPI      "*IDN?\n"
+#define ID_LENGTH_MAX          1024
+#define TRANSPORT_SAMPLES         3 // *IDN? round trips timed per transport
+#define TRANSPORT_CACHE_MAX      64
+#define ADDRESS_LENGTH_MAX      256
+#define NAME_LENGTH_MAX          64
+
+typedef struct
+{
+    const char *address;
+    const char *name;
+    int timeout;
+    lxi_transport_probe_t *probe;
+    int device;
+} transport_job_t;
+
+typedef struct
+{
+    char address[ADDRESS_LENGTH_MAX];
+    char name[NAME_LENGTH_MAX];
+    lxi_transport_t transport;
+    time_t last_used;
+} transport_cache_t;
+
+// Probed in order of preference when equally fast
+static const struct
+{
+    lxi_protocol_t protocol;
+    int port;
+} transport_candidates[LXI_TRANSPORT_PROBES_MAX] =
+{
+    { HISLIP, PORT_HISLIP },
+    { VXI11, 0 },
+    { RAW, PORT_RAW },
+};
+
+static transport_cache_t transport_cache[TRANSPORT_CACHE_MAX];
+static int transport_cache_count = 0;
+static pthread_mutex_t transport_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static long long time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static transport_cache_t *transport_cache_find(const char *address, const char *name)
+{
+    int i;
+
+    for (i = 0; i < transport_cache_count; i++)
+    {
+        if ((strcmp(transport_cache[i].address, address) == 0) && (strcmp(transport_cache[i].name, name) == 0))
+            return &transport_cache[i];
+    }
+
+    return NULL;
+}
+
+// Remember transport picked for instrument, replacing least recently used if full
+static void transport_cache_store(const char *address, const char *name, const lxi_transport_t *transport)
+{
+    transport_cache_t *entry;
+    int i;
+
+    if ((strlen(address) >= ADDRESS_LENGTH_MAX) || (strlen(name) >= NAME_LENGTH_MAX))
+        return;
+
+    pthread_mutex_lock(&transport_mutex);
+
+    entry = transport_cache_find(address, name);
+    if ((entry == NULL) && (transport_cache_count < TRANSPORT_CACHE_MAX))
+        entry = &transport_cache[transport_cache_count++];
+    else if (entry == NULL)
+    {
+        entry = &transport_cache[0];
+        for (i = 1; i < TRANSPORT_CACHE_MAX; i++)
+        {
+            if (transport_cache[i].last_used < entry->last_used)
+                entry = &transport_cache[i];
+        }
+    }
+
+    strcpy(entry->address, address);
+    strcpy(entry->name, name);
+    entry->transport = *transport;
+    entry->transport.cached = 0;
+    entry->last_used = time(NULL);
+
+    pthread_mutex_unlock(&transport_mutex);
+}
+
+static bool transport_cache_load(const char *address, const char *name, lxi_transport_t *transport)
+{
+    transport_cache_t *entry;
+
+    pthread_mutex_lock(&transport_mutex);
+
+    entry = transport_cache_find(address, name);
+    if (entry != NULL)
+    {
+        *transport = entry->transport;
+        transport->cached = 1;
+        entry->last_used = time(NULL);
+    }
+
+    pthread_mutex_unlock(&transport_mutex);
+
+    return entry != NULL;
+}
+
+// Transport no longer working is probed again next time
+static void transport_cache_remove(const char *address, const char *name)
+{
+    transport_cache_t *entry;
+
+    pthread_mutex_lock(&transport_mutex);
+
+    entry = transport_cache_find(address, name);
+    if (entry != NULL)
+        *entry = transport_cache[--transport_cache_count];
+
+    pthread_mutex_unlock(&transport_mutex);
+}
+
+// Connect and time *IDN? round trips, leaving connection open if it works
+static void *thread_transport_probe(void *ptr)
+{
+    transport_job_t *job = ptr;
+    lxi_transport_probe_t *probe = job->probe;
+    char id[ID_LENGTH_MAX];
+    long long start, total = 0;
+    int i;
+
+    probe->status = LXI_ERROR;
+
+    job->device = lxi_connect(job->address, probe->port, job->name, job->timeout, probe->protocol);
+    if (job->device < 0)
+        return NULL;
+
+    for (i = 0; i < TRANSPORT_SAMPLES; i++)
+    {
+        start = time_us();
+
+        if (lxi_send(job->device, ID_REQ_SCPI, strlen(ID_REQ_SCPI), job->timeout) < 0)
+            goto error_sample;
+        if (lxi_receive(job->device, id, sizeof(id), job->timeout) <= 0)
+            goto error_sample;
+
+        total += time_us() - start;
+    }
+
+    probe->latency = (int) (total / TRANSPORT_SAMPLES);
+    probe->status = LXI_OK;
+
+    return NULL;
+
+error_sample:
+    lxi_disconnect(job->device);
+    job->device = LXI_ERROR;
+    return NULL;
+}
+
+// Try all transports at once and keep fastest connection working
+static int transport_probe(const char *address, const char *name, int timeout, lxi_transport_t *transport)
+{
+    transport_job_t jobs[LXI_TRANSPORT_PROBES_MAX];
+    pthread_t threads[LXI_TRANSPORT_PROBES_MAX];
+    bool started[LXI_TRANSPORT_PROBES_MAX];
+    int best = -1;
+    int device = LXI_ERROR;
+    int i;
+
+    memset(transport, 0, sizeof(lxi_transport_t));
+    transport->probe_count = LXI_TRANSPORT_PROBES_MAX;
+
+    for (i = 0; i < LXI_TRANSPORT_PROBES_MAX; i++)
+    {
+        transport->probes[i].protocol = transport_candidates[i].protocol;
+        transport->probes[i].port = transport_candidates[i].port;
+
+        jobs[i].address = address;
+        jobs[i].name = name;
+        jobs[i].timeout = timeout;
+        jobs[i].probe = &transport->probes[i];
+        jobs[i].device = LXI_ERROR;
+
+        // Probed in this thread if no thread could be started
+        started[i] = (pthread_create(&threads[i], NULL, thread_transport_probe, &jobs[i]) == 0);
+        if (!started[i])
+            thread_transport_probe(&jobs[i]);
+    }
+
+    for (i = 0; i < LXI_TRANSPORT_PROBES_MAX; i++)
+    {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+
+        if (transport->probes[i].status != LXI_OK)
+            continue;
+
+        if ((best < 0) || (transport->probes[i].latency < transport->probes[best].latency))
+            best = i;
+    }
+
+    for (i = 0; i < LXI_TRANSPORT_PROBES_MAX; i++)
+    {
+        if (i == best)
+            device = jobs[i].device;
+        else if (jobs[i].device >= 0)
+            lxi_disconnect(jobs[i].device);
+    }
+
+    if (best < 0)
+    {
+        error_printf("No transport available for %s\n", address);
+        return LXI_ERROR;
+    }
+
+    transport->protocol = transport->probes[best].protocol;
+    transport->port = transport->probes[best].port;
+
+    return device;
+}
+
+int transport_connect(const char *address, const char *name, int timeout, lxi_transport_t *transport)
+{
+    const char *key = (name != NULL) ? name : "";
+    int device;
+
+    // Transport picked before is used again without probing
+    if (transport_cache_load(address, key, transport))
+    {
+        device = lxi_connect(address, transport->port, name, timeout, transport->protocol);
+        if (device >= 0)
+            return device;
+
+        transport_cache_remove(address, key);
+    }
+
+    device = transport_probe(address, name, timeout, transport);
+    if (device < 0)
+        return LXI_ERROR;
+
+    transport_cache_store(address, key, transport);
+
+    return device;
+}
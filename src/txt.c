@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2017-2022  Martin Lund
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "txt.h"
+
+// Add "key=value" item of TXT record, only first occurrence of a key counts
+int mdns_txt_add(mdns_txt_t *txt, const char *item, size_t length)
+{
+    lxi_txt_t *items;
+    const char *equal;
+    size_t key_length;
+    char *copy;
+    int i;
+
+    equal = memchr(item, '=', length);
+    key_length = (equal != NULL) ? (size_t) (equal - item) : length;
+
+    // Items without key carry no information
+    if (key_length == 0)
+        return 0;
+
+    for (i = 0; i < txt->count; i++)
+    {
+        if ((strlen(txt->items[i].key) == key_length) && (strncasecmp(txt->items[i].key, item, key_length) == 0))
+            return 0;
+    }
+
+    items = realloc(txt->items, (txt->count + 1) * sizeof(lxi_txt_t));
+    if (items == NULL)
+        return -1;
+    txt->items = items;
+
+    // Key and value share one allocation
+    copy = malloc(length + 1);
+    if (copy == NULL)
+        return -1;
+    memcpy(copy, item, length);
+    copy[key_length] = 0;
+    copy[length] = 0;
+
+    // Key without value is a boolean attribute
+    items[txt->count].key = copy;
+    items[txt->count].value = (equal != NULL) ? copy + key_length + 1 : NULL;
+    txt->count++;
+
+    return 0;
+}
+
+// Add items of raw TXT record data, each prefixed by its length
+int mdns_txt_parse(mdns_txt_t *txt, const unsigned char *data, size_t length)
+{
+    size_t offset = 0;
+    size_t item_length;
+
+    while (offset < length)
+    {
+        item_length = data[offset++];
+        if (item_length > length - offset)
+            break;
+
+        if (mdns_txt_add(txt, (const char *) data + offset, item_length) != 0)
+            return -1;
+        offset += item_length;
+    }
+
+    return 0;
+}
+
+void mdns_txt_free(mdns_txt_t *txt)
+{
+    int i;
+
+    for (i = 0; i < txt->count; i++)
+        free((char *) txt->items[i].key);
+    free(txt->items);
+
+    txt->items = NULL;
+    txt->count = 0;
+}
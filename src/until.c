@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2017-2022  Martin Lund
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fnmatch.h>
+#include <lxi.h>
+#include "until.h"
+#include "vxi11.h"
+#include "mdns.h"
+
+typedef struct
+{
+    lxi_info_t *info;
+    const lxi_discover_until_t *until;
+    char **addresses;
+    int count;
+    bool reached;
+} until_t;
+
+// Stop conditions of the discovery running in this thread, checked by the backends
+static __thread until_t *until_current = NULL;
+
+static void until_found(const char *address, const char *id)
+{
+    until_t *until = until_current;
+    char **addresses;
+    int i;
+
+    // Count devices, not the services each of them announces
+    for (i = 0; i < until->count; i++)
+    {
+        if (strcmp(until->addresses[i], address) == 0)
+            break;
+    }
+
+    if (i == until->count)
+    {
+        addresses = realloc(until->addresses, (until->count + 1) * sizeof(char *));
+        if (addresses != NULL)
+        {
+            until->addresses = addresses;
+            addresses[until->count] = strdup(address);
+            if (addresses[until->count] != NULL)
+                until->count++;
+        }
+    }
+
+    if ((until->until->count > 0) && (until->count >= until->until->count))
+        until->reached = true;
+
+    if ((until->until->match != NULL) && (id != NULL) && (fnmatch(until->until->match, id, FNM_CASEFOLD) == 0))
+        until->reached = true;
+}
+
+static void until_broadcast(const char *address, const char *interface)
+{
+    until_t *until = until_current;
+
+    until_current = NULL;
+    until->info->broadcast(address, interface);
+    until_current = until;
+}
+
+// Caller is notified first, its callback may run a discovery of its own
+static void until_device(const char *address, const char *id)
+{
+    until_t *until = until_current;
+
+    if (until->info->device != NULL)
+    {
+        until_current = NULL;
+        until->info->device(address, id);
+        until_current = until;
+    }
+
+    until_found(address, id);
+}
+
+static void until_service(const char *address, const char *id, const char *service, int port)
+{
+    until_t *until = until_current;
+
+    if (until->info->service != NULL)
+    {
+        until_current = NULL;
+        until->info->service(address, id, service, port);
+        until_current = until;
+    }
+
+    until_found(address, id);
+}
+
+// Search like lxi_discover_if() but return as soon as a stop condition is met
+int until_discover(lxi_info_t *info, const char *ifname, int timeout, lxi_discover_t type,
+        const lxi_discover_until_t *until)
+{
+    lxi_info_t until_info;
+    until_t state;
+    until_t *previous;
+    int status = 0;
+    int i;
+
+    memset(&state, 0, sizeof(state));
+    state.info = info;
+    state.until = until;
+
+    memset(&until_info, 0, sizeof(until_info));
+    if (info->broadcast != NULL)
+        until_info.broadcast = until_broadcast;
+    until_info.device = until_device;
+    until_info.service = until_service;
+
+    previous = until_current;
+    until_current = &state;
+
+    if ((type == DISCOVER_VXI11) || (type == DISCOVER_ALL))
+    {
+        if (ifname == NULL)
+            status = vxi11_discover(&until_info, timeout);
+        else
+            status = vxi11_discover_if(&until_info, ifname, timeout);
+    }
+
+    if ((status == 0) && !state.reached && ((type == DISCOVER_MDNS) || (type == DISCOVER_ALL)))
+        status = mdns_discover_if(&until_info, ifname, timeout);
+
+    until_current = previous;
+
+    for (i = 0; i < state.count; i++)
+        free(state.addresses[i]);
+    free(state.addresses);
+
+    if (status != 0)
+        return -1;
+
+    return state.reached ? 1 : 0;
+}
+
+// True once the discovery running in this thread may stop
+bool until_reached(void)
+{
+    return (until_current != NULL) && until_current->reached;
+}
+
+// Backend reports that browsing has nothing more for now
+void until_settled(void)
+{
+    if ((until_current != NULL) && until_current->until->all_for_now)
+        until_current->reached = true;
+}
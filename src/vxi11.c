@@ -39,22 +39,39 @@
 #include <arpa/inet.h>
 #include <ifaddrs.h>
 #include <rpc/rpc.h>
-#include <libxml/xmlmemory.h>
-#include <libxml/parser.h>
 #include <pthread.h>
 #include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
 #include "vxi11core.h"
 #include "vxi11.h"
 #include "tcp.h"
+#include "hislip.h"
+#include "cache.h"
+#include "session.h"
+#include "identify.h"
+#include "until.h"
 #include "error.h"
 
-#define PORT_HTTP                80
 #define PORT_RPC                111
-#define ID_REQ_HTTP "GET /lxi/identification HTTP/1.0\r\n\r\n";
+#define PORT_RAW               5025
+#define PORT_HISLIP            4880
 #define ID_REQ_SCPI       "*IDN?\n"
-#define ID_LENGTH_MAX         65536
+#define ID_LENGTH_MAX          1024 // Generous for *IDN? responses (IEEE 488.2 allows 72 characters)
+#define REPLY_LENGTH_MAX        128 // Portmapper GETPORT reply is 28 bytes
+#define REPLY_PORT_OFFSET        24 // Port in accepted GETPORT reply
+#define DISCOVER_WORKERS_MAX      8 // Devices identified concurrently
+#define SWEEP_RATE_DEFAULT     1000 // Probes sent per second
+#define SWEEP_HOSTS_MAX       65536 // Largest sweep accepted, a /16
+#define SWEEP_CONNECTS_MAX      512 // TCP probes in flight
 #define RECEIVE_END_BIT        0x04 // Receive end indicator
 #define RECEIVE_TERM_CHAR_BIT  0x02 // Receive termination character
+#define RPC_TIMEOUT_MARGIN      500 // Extra time for device to report its own timeout
+#define FLAG_WAIT_LOCK         0x01 // Wait for lock held by another link
+#define FLAG_END               0x08 // Write ends with END indicator
+#define FLAG_TERM_CHAR_SET     0x80 // Terminate read on termination character
 
 
 typedef struct
@@ -66,6 +83,78 @@ typedef struct
     int timeout;
 } thread_vxi11_connect_args_t;
 
+typedef struct
+{
+    pthread_once_t once;
+    pthread_mutex_t mutex;
+    unsigned short port;
+    void (*handler)(int handle);
+} intr_server_t;
+
+typedef struct
+{
+    int (*connect)(void *data, const char *address, int port, const char *name, int timeout);
+    int (*disconnect)(void *data);
+    int (*send)(void *data, const char *message, int length, int timeout);
+    int (*receive)(void *data, char *message, int length, int timeout);
+} identify_ops_t;
+
+typedef struct discover_job
+{
+    char address[INET_ADDRSTRLEN];
+    char id[ID_LENGTH_MAX];
+    lxi_protocol_t protocol;
+    unsigned short port; // Core channel of VXI-11 device, otherwise port probed
+    int status;
+    struct discover_job *next;
+} discover_job_t;
+
+typedef struct
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t threads[DISCOVER_WORKERS_MAX];
+    int workers;
+    int idle;
+    bool closing;
+    discover_job_t *queue;
+    discover_job_t *done;
+    int wakeup[2];
+    int timeout;
+} discover_pool_t;
+
+typedef struct
+{
+    cache_entry_t *entries;
+    bool *reported;
+    int count;
+} discover_cache_t;
+
+typedef struct
+{
+    lxi_info_t *info;
+    discover_pool_t pool;
+    discover_cache_t cache;
+    struct in_addr *seen;
+    int seen_count;
+    int outstanding;
+} discover_t;
+
+typedef struct
+{
+    uint32_t first;
+    uint32_t count;
+} sweep_range_t;
+
+typedef struct
+{
+    int fd;
+    struct in_addr address;
+    lxi_protocol_t protocol;
+    unsigned short port;
+    long long deadline;
+} sweep_connect_t;
+
 typedef struct
 {
     int joined;
@@ -88,6 +177,57 @@ static char rpc_GETPORT_msg[] =
     0x00, 0x00, 0x00, 0x06, 0x00, 0x00, 0x00, 0x00
 };
 
+// Sessions used to request identification of discovered devices
+static const identify_ops_t identify_ops[] =
+{
+    [VXI11]  = { vxi11_connect, vxi11_disconnect, vxi11_send, vxi11_receive },
+    [RAW]    = { tcp_connect, tcp_disconnect, tcp_send, tcp_receive },
+    [HISLIP] = { hislip_connect, hislip_disconnect, hislip_send, hislip_receive },
+};
+
+
+// Interrupt channel server shared by all sessions
+static intr_server_t intr_server =
+{
+    .once = PTHREAD_ONCE_INIT,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .port = 0,
+    .handler = NULL,
+};
+
+
+static long long time_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Time left of caller's timeout, lock wait and I/O of an operation share it
+static int remaining_ms(long long deadline)
+{
+    long long remaining = deadline - time_ms();
+
+    return (remaining > 0) ? (int) remaining : 0;
+}
+
+// Perform RPC call with timeout derived from the caller's timeout instead of
+// the fixed default timeout used by the generated client stubs
+static enum clnt_stat vxi11_call(CLIENT *client, rpcproc_t procedure,
+        xdrproc_t xdr_args, void *args, xdrproc_t xdr_result, void *result, int timeout)
+{
+    struct timeval tv;
+
+    // Give device a chance to report its own timeout before giving up
+    timeout += RPC_TIMEOUT_MARGIN;
+
+    tv.tv_sec = timeout / 1000;
+    tv.tv_usec = (timeout % 1000) * 1000;
+
+    return clnt_call(client, procedure, xdr_args, (caddr_t) args, xdr_result, (caddr_t) result, tv);
+}
 
 // A POSIX compatible pthread_timedjoin_np
 static void *_pthread_waiter(void *ap)
@@ -130,9 +270,24 @@ static int _pthread_timedjoin(pthread_t td, void **res, struct timespec *ts)
 static int _vxi11_connect(void *data, const char *address, int port, const char *name, int timeout)
 {
     Create_LinkParms link_params;
+    socklen_t addrlen = sizeof(struct sockaddr_in);
+    int sockfd;
 
     vxi11_data_t *vxi11_data = (vxi11_data_t *) data;
 
+    // Use connect timeout for calls which have no timeout of their own
+    vxi11_data->timeout = timeout;
+
+    // Reads only terminate on END until configured otherwise
+    vxi11_data->termchar = LXI_TERMCHAR_NONE;
+
+    // Abort channel is connected on first use
+    vxi11_data->abort_client = NULL;
+    pthread_mutex_init(&vxi11_data->abort_mutex, NULL);
+
+    // Interrupt channel is created when service requests are enabled
+    vxi11_data->intr_chan = false;
+
     // Set up client
     vxi11_data->rpc_client = clnt_create(address, DEVICE_CORE, DEVICE_CORE_VERSION, "tcp");
     if (vxi11_data->rpc_client == NULL)
@@ -148,7 +303,21 @@ static int _vxi11_connect(void *data, const char *address, int port, const char
     else
         link_params.device = (char *) name; // Use provided device name
 
-    if (create_link_1(&link_params, &vxi11_data->link_resp, vxi11_data->rpc_client) != RPC_SUCCESS)
+    if (vxi11_call(vxi11_data->rpc_client, create_link,
+            (xdrproc_t) xdr_Create_LinkParms, &link_params,
+            (xdrproc_t) xdr_Create_LinkResp, &vxi11_data->link_resp, timeout) != RPC_SUCCESS)
+        goto error_link;
+
+    // Remember server address for connecting secondary channels later. Note:
+    // clnt_control() can't be used for this while a call is in progress.
+    if (!clnt_control(vxi11_data->rpc_client, CLGET_FD, (char *) &sockfd))
+        goto error_link;
+    if (getpeername(sockfd, (struct sockaddr *) &vxi11_data->server_addr, &addrlen) != 0)
+        goto error_link;
+
+    // Remember local address as seen by device for interrupt channel setup
+    addrlen = sizeof(struct sockaddr_in);
+    if (getsockname(sockfd, (struct sockaddr *) &vxi11_data->client_addr, &addrlen) != 0)
         goto error_link;
 
     return 0;
@@ -232,9 +401,21 @@ int vxi11_disconnect(void *data)
 
     vxi11_data_t *vxi11_data = (vxi11_data_t *) data;
 
-    destroy_link_1(&vxi11_data->link_resp.lid, &device_error, vxi11_data->rpc_client);
+    // Stop device from sending service requests to us
+    if (vxi11_data->intr_chan)
+        vxi11_call(vxi11_data->rpc_client, destroy_intr_chan,
+                (xdrproc_t) (void (*)(void)) xdr_void, NULL,
+                (xdrproc_t) xdr_Device_Error, &device_error, vxi11_data->timeout);
+
+    vxi11_call(vxi11_data->rpc_client, destroy_link,
+            (xdrproc_t) xdr_Device_Link, &vxi11_data->link_resp.lid,
+            (xdrproc_t) xdr_Device_Error, &device_error, vxi11_data->timeout);
     clnt_destroy(vxi11_data->rpc_client);
 
+    if (vxi11_data->abort_client != NULL)
+        clnt_destroy(vxi11_data->abort_client);
+    pthread_mutex_destroy(&vxi11_data->abort_mutex);
+
     return 0;
 }
 
@@ -242,29 +423,72 @@ int vxi11_send(void *data, const char *message, int length, int timeout)
 {
     Device_WriteParms write_params;
     Device_WriteResp write_resp;
+    long long deadline = time_ms() + timeout;
+    int chunk_max, chunk;
+    int offset = 0;
 
     vxi11_data_t *vxi11_data = (vxi11_data_t *) data;
 
+    // Device accepts no more than maxRecvSize bytes per write
+    chunk_max = (int) vxi11_data->link_resp.maxRecvSize;
+    if (chunk_max <= 0)
+        chunk_max = length;
+
     // Configure VXI11 write parameters
     write_params.lid = vxi11_data->link_resp.lid;
-    write_params.lock_timeout = 0;
-    write_params.io_timeout = timeout;
-    write_params.flags = 0x9;
-    write_params.data.data_len = length;
-    write_params.data.data_val = (char *) message;
-
-    // Send
-    if (device_write_1(&write_params, &write_resp, vxi11_data->rpc_client) != RPC_SUCCESS)
-        return -1;
+
+    // Send until all data is sent, whole write ends by caller's deadline
+    do
+    {
+        chunk = length - offset;
+        write_params.flags = FLAG_WAIT_LOCK | FLAG_END;
+        if (chunk > chunk_max)
+        {
+            chunk = chunk_max;
+            write_params.flags = FLAG_WAIT_LOCK;
+        }
+        write_params.data.data_len = chunk;
+        write_params.data.data_val = (char *) message + offset;
+
+        timeout = remaining_ms(deadline);
+        if ((timeout == 0) && (offset > 0))
+        {
+            error_printf("Write error (timeout)\n");
+            return -1;
+        }
+        write_params.lock_timeout = timeout;
+        write_params.io_timeout = timeout;
+
+        memset(&write_resp, 0, sizeof(write_resp));
+        if (vxi11_call(vxi11_data->rpc_client, device_write,
+                (xdrproc_t) xdr_Device_WriteParms, &write_params,
+                (xdrproc_t) xdr_Device_WriteResp, &write_resp, timeout) != RPC_SUCCESS)
+            return -1;
+
+        if (write_resp.error != 0)
+        {
+            if (write_resp.error == 15)
+                error_printf("Write error (timeout)\n");
+            else if (write_resp.error == 23)
+                error_printf("Write error (aborted)\n");
+            else
+                error_printf("Write error (response error code %d)\n", (int) write_resp.error);
+            return -1;
+        }
+
+        offset += write_resp.size;
+
+    } while ((offset < length) && (write_resp.size > 0));
 
     // Return number of bytes sent
-    return write_resp.size;
+    return offset;
 }
 
 int vxi11_receive(void *data, char *message, int length, int timeout)
 {
     Device_ReadParms read_params;
     Device_ReadResp read_resp;
+    long long deadline = time_ms() + timeout;
     int response_length = 0;
     int offset = 0;
 
@@ -272,12 +496,17 @@ int vxi11_receive(void *data, char *message, int length, int timeout)
 
     // Configure VXI11 read parameters
     read_params.lid = vxi11_data->link_resp.lid;
-    read_params.lock_timeout = 0;
-    read_params.io_timeout = timeout;
-    read_params.flags = 0;
+    read_params.flags = FLAG_WAIT_LOCK;
     read_params.termChar = 0;
     read_params.requestSize = length;
 
+    // Let device terminate read on termination character if configured
+    if (vxi11_data->termchar != LXI_TERMCHAR_NONE)
+    {
+        read_params.flags |= FLAG_TERM_CHAR_SET;
+        read_params.termChar = (char) vxi11_data->termchar;
+    }
+
     // Receive until done
     do
     {
@@ -286,13 +515,27 @@ int vxi11_receive(void *data, char *message, int length, int timeout)
         read_resp.data.data_val = message + offset;
         read_params.requestSize = length - offset;
 
-        if (device_read_1(&read_params, &read_resp, vxi11_data->rpc_client) != RPC_SUCCESS)
+        // Whole read, however many chunks it takes, ends by caller's deadline
+        timeout = remaining_ms(deadline);
+        if ((timeout == 0) && (offset > 0))
+        {
+            error_printf("Read error (timeout)\n");
+            return -1;
+        }
+        read_params.lock_timeout = timeout;
+        read_params.io_timeout = timeout;
+
+        if (vxi11_call(vxi11_data->rpc_client, device_read,
+                (xdrproc_t) xdr_Device_ReadParms, &read_params,
+                (xdrproc_t) xdr_Device_ReadResp, &read_resp, timeout) != RPC_SUCCESS)
             return -1;
 
         if (read_resp.error != 0)
         {
             if (read_resp.error == 15)
                 error_printf("Read error (timeout)\n"); // Most common error explained
+            else if (read_resp.error == 23)
+                error_printf("Read error (aborted)\n");
             else
                 error_printf("Read error (response error code %d)\n", (int) read_resp.error);
             return -1;
@@ -322,281 +565,1480 @@ int vxi11_receive(void *data, char *message, int length, int timeout)
     return response_length;
 }
 
-int vxi11_lock(void *data)
+int vxi11_set_termchar(void *data, int termchar)
 {
+    vxi11_data_t *vxi11_data = (vxi11_data_t *) data;
+
+    vxi11_data->termchar = termchar;
+
     return 0;
 }
 
-int vxi11_unlock(void *data)
+static CLIENT *abort_client_create(vxi11_data_t *vxi11_data)
 {
-    return 0;
+    struct sockaddr_in abort_addr;
+    struct pollfd pfd;
+    socklen_t length = sizeof(int);
+    CLIENT *client;
+    int sockfd;
+    int error = 0;
+
+    // Abort channel is served by the same host as the core channel, on the
+    // port announced by the device at link creation
+    abort_addr = vxi11_data->server_addr;
+    abort_addr.sin_port = htons(vxi11_data->link_resp.abortPort);
+
+    // Connect within session timeout, a dead link must not hang the abort
+    sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sockfd < 0)
+        return NULL;
+
+    if ((connect(sockfd, (struct sockaddr *) &abort_addr, sizeof(abort_addr)) < 0) && (errno != EINPROGRESS))
+        goto error;
+
+    pfd.fd = sockfd;
+    pfd.events = POLLOUT;
+    if (poll(&pfd, 1, vxi11_data->timeout) != 1)
+        goto error;
+
+    if ((getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &error, &length) != 0) || (error != 0))
+        goto error;
+
+    if (fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) & ~O_NONBLOCK) < 0)
+        goto error;
+
+    client = clnttcp_create(&abort_addr, DEVICE_ASYNC, DEVICE_ASYNC_VERSION, &sockfd, 0, 0);
+    if (client == NULL)
+        goto error;
+
+    // Socket passed in is not closed by clnt_destroy() otherwise
+    clnt_control(client, CLSET_FD_CLOSE, NULL);
+
+    return client;
+
+error:
+    close(sockfd);
+    return NULL;
 }
 
-static xmlChar *get_element_value(xmlDocPtr doc, xmlChar *element)
+int vxi11_abort(void *data)
 {
-    xmlNodePtr node;
-    xmlChar *value = NULL;
-    node = xmlDocGetRootElement(doc);
-    node = node->xmlChildrenNode;
-    while (node != NULL)
+    Device_Error device_error;
+    int status = -1;
+
+    vxi11_data_t *vxi11_data = (vxi11_data_t *) data;
+
+    pthread_mutex_lock(&vxi11_data->abort_mutex);
+
+    // Connect abort channel on first use
+    if (vxi11_data->abort_client == NULL)
     {
-        if ((!xmlStrcmp(node->name, element)))
+        vxi11_data->abort_client = abort_client_create(vxi11_data);
+        if (vxi11_data->abort_client == NULL)
         {
-            value = xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
-            break;
+            error_printf("Unable to connect abort channel\n");
+            goto error_client;
         }
-        node = node->next;
     }
 
-    return value;
-}
-
-static int get_device_id(char *address, char *id, int timeout)
-{
-    vxi11_data_t data;
-    int length;
-    int device;
+    // Abort any in-progress call on the core channel
+    if (vxi11_call(vxi11_data->abort_client, device_abort,
+            (xdrproc_t) xdr_Device_Link, &vxi11_data->link_resp.lid,
+            (xdrproc_t) xdr_Device_Error, &device_error, vxi11_data->timeout) != RPC_SUCCESS)
+        goto error_abort;
 
-    device = vxi11_connect(&data, address, 0, NULL, timeout);
-    if (device < 0)
-        goto error_connect;
+    if (device_error.error != 0)
+    {
+        error_printf("Abort error (response error code %d)\n", (int) device_error.error);
+        goto error_abort;
+    }
 
-    length = vxi11_send(&data, ID_REQ_SCPI, strlen(ID_REQ_SCPI), timeout);
-    if (length < 0)
-        goto error_send;
+    status = 0;
 
-    length = vxi11_receive(&data, id, ID_LENGTH_MAX, timeout);
-    if (length < 0)
-        goto error_receive;
+error_abort:
+error_client:
+    pthread_mutex_unlock(&vxi11_data->abort_mutex);
+    return status;
+}
 
-    vxi11_disconnect(&data);
+static void device_intr_1(struct svc_req *rqstp, SVCXPRT *transp)
+{
+    Device_SrqParms srq_params;
+    void (*handler)(int handle);
+    uint32_t handle;
 
-    // Terminate string
-    id[length] = 0;
+    if (rqstp->rq_proc != device_intr_srq)
+    {
+        svcerr_noproc(transp);
+        return;
+    }
 
-    if (length > 0)
+    memset(&srq_params, 0, sizeof(srq_params));
+    if (!svc_getargs(transp, (xdrproc_t) xdr_Device_SrqParms, (caddr_t) &srq_params))
     {
-        // Strip newline
-        if (id[length-1] == '\n')
-            id[--length] = 0;
+        svcerr_decode(transp);
+        return;
+    }
 
-        // Strip carriage return
-        if (id[length-1] == '\r')
-            id[--length] = 0;
-    } else
+    // Service requests are one-way calls so no reply is sent. The handle
+    // identifies the session which enabled service requests.
+    if (srq_params.handle.handle_len == sizeof(handle))
     {
-        // Fallback - try retrieve ID via HTTP/XML
-        char *request = ID_REQ_HTTP;
-        char response[4096];
-        char *response_xml;
-        tcp_data_t tcp_data;
-        xmlDocPtr doc;
-        xmlChar *value;
-
-        // Mute stderr temporarily
-        freopen("/dev/null", "w", stderr);
-
-        // Get XML identification file
-        tcp_connect(&tcp_data, address, PORT_HTTP, NULL, timeout);
-        tcp_send(&tcp_data, request, strlen(request), timeout);
-        tcp_receive_wait(&tcp_data, response, 4096, timeout);
-        tcp_disconnect(&tcp_data);
-
-        // Find start of XML
-        response_xml = strstr(response, "<?xml");
-        if (response_xml == NULL)
-            goto error_xml_response;
-
-        // Read XML from memory
-        doc = xmlRecoverMemory(response_xml, strlen(response_xml));
-        if (doc == NULL)
-            goto error_xml_read;
-
-        // Assemble ID string
-        id[0] = 0;
-
-        value = get_element_value(doc, (xmlChar *)"Manufacturer");
-        strcat(id, (char *) value);
-        strcat(id, ",");
-        xmlFree(value);
-
-        value = get_element_value(doc, (xmlChar *)"Model");
-        strcat(id, (char *) value);
-        strcat(id, ",");
-        xmlFree(value);
-
-        value = get_element_value(doc, (xmlChar *)"SerialNumber");
-        strcat(id, (char *) value);
-        strcat(id, ",");
-        xmlFree(value);
-
-        value = get_element_value(doc, (xmlChar *)"FirmwareRevision");
-        strcat(id, (char *) value);
-        xmlFree(value);
-
-        xmlFreeDoc(doc);
-        xmlCleanupParser();
+        memcpy(&handle, srq_params.handle.handle_val, sizeof(handle));
+
+        pthread_mutex_lock(&intr_server.mutex);
+        handler = intr_server.handler;
+        pthread_mutex_unlock(&intr_server.mutex);
+
+        if (handler != NULL)
+            handler((int) ntohl(handle));
     }
 
-    return 0;
+    svc_freeargs(transp, (xdrproc_t) xdr_Device_SrqParms, (caddr_t) &srq_params);
+}
 
-error_receive:
-error_send:
-    vxi11_disconnect(&data);
-error_connect:
-    return -1;
+static void *thread_intr_server(void *ptr)
+{
+    // Serve interrupt channel connections for the lifetime of the process
+    svc_run();
 
-error_xml_read:
-error_xml_response:
-    // Restore stderr
-    freopen("/dev/tty", "w", stderr);
-    return -1;
+    error_printf("Interrupt channel server stopped\n");
+
+    return NULL;
 }
 
-static int discover_devices(struct sockaddr_in *broadcast_addr, lxi_info_t *info, int timeout)
+static void intr_server_init(void)
 {
-    int sockfd;
-    struct sockaddr_in send_addr;
-    struct sockaddr_in recv_addr;
-    int broadcast = true;
-    int count;
-    char buffer[ID_LENGTH_MAX];
-    char id[ID_LENGTH_MAX];
-    struct timeval tv;
-    socklen_t addrlen;
+    SVCXPRT *transp;
+    pthread_t thread;
 
-    // Create a socket
-    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sockfd == -1)
+    transp = svctcp_create(RPC_ANYSOCK, 0, 0);
+    if (transp == NULL)
     {
-        error_printf("Socket creation error");
-        return -1;
+        error_printf("Unable to create interrupt channel server\n");
+        return;
     }
 
-    // Set socket options - broadcast
-    if((setsockopt(sockfd, SOL_SOCKET, SO_BROADCAST,
-                    &broadcast,sizeof (broadcast))) == -1)
+    // Devices are told our port directly so skip portmapper registration
+    if (!svc_register(transp, DEVICE_INTR, DEVICE_INTR_VERSION, device_intr_1, 0))
     {
-        error_printf("setsockopt - SO_SOCKET");
-        goto socket_options_error;
+        error_printf("Unable to register interrupt channel server\n");
+        svc_destroy(transp);
+        return;
     }
 
-    // Set socket options - timeout
-    tv.tv_sec = timeout / 1000;
-    tv.tv_usec = (timeout % 1000) * 1000;
-    if ((setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv))) == -1)
+    if (pthread_create(&thread, NULL, thread_intr_server, NULL) != 0)
     {
-        error_printf("setsockopt - SO_RCVTIMEO");
-        goto socket_options_error;
+        error_printf("Error pthread_create()\n");
+        svc_unregister(DEVICE_INTR, DEVICE_INTR_VERSION);
+        svc_destroy(transp);
+        return;
     }
+    pthread_detach(thread);
 
-    // Senders address
-    send_addr.sin_family = AF_INET;
-    send_addr.sin_addr.s_addr = INADDR_ANY;
-    send_addr.sin_port = 0;     // 0 = random sender port
+    intr_server.port = transp->xp_port;
+}
 
-    // Bind socket to address
-    bind(sockfd, (struct sockaddr*)&send_addr, sizeof(send_addr));
+int vxi11_enable_srq(void *data, int handle, void (*handler)(int handle))
+{
+    Device_EnableSrqParms srq_params;
+    Device_RemoteFunc remote_func;
+    Device_Error device_error;
+    uint32_t srq_handle = htonl((uint32_t) handle);
 
-    // Receivers address
-    recv_addr.sin_family = AF_INET;
-    recv_addr.sin_addr.s_addr = broadcast_addr->sin_addr.s_addr;
-    recv_addr.sin_port = htons(PORT_RPC);
+    vxi11_data_t *vxi11_data = (vxi11_data_t *) data;
 
-    // Broadcast RPC GETPORT message
-    sendto(sockfd, rpc_GETPORT_msg, sizeof(rpc_GETPORT_msg), 0,
-            (struct sockaddr*)&recv_addr, sizeof(recv_addr));
+    if (handler != NULL)
+    {
+        pthread_mutex_lock(&intr_server.mutex);
+        intr_server.handler = handler;
+        pthread_mutex_unlock(&intr_server.mutex);
 
-    addrlen = sizeof(recv_addr);
+        // Start interrupt channel server on first use
+        pthread_once(&intr_server.once, intr_server_init);
+        if (intr_server.port == 0)
+            return -1;
 
-    // Go through received responses
-    do
-    {
-        count = recvfrom(sockfd, buffer, ID_LENGTH_MAX, 0,
-                (struct sockaddr*)&recv_addr, &addrlen);
-        if (count > 0)
+        // Ask device to connect its interrupt channel to our server
+        if (!vxi11_data->intr_chan)
         {
-            // Add device if an LXI ID string is returned
-            char *address = inet_ntoa(recv_addr.sin_addr);
-            if (get_device_id(address, id, timeout) == 0)
+            remote_func.hostAddr = ntohl(vxi11_data->client_addr.sin_addr.s_addr);
+            remote_func.hostPort = intr_server.port;
+            remote_func.progNum = DEVICE_INTR;
+            remote_func.progVers = DEVICE_INTR_VERSION;
+            remote_func.progFamily = DEVICE_TCP;
+
+            if (vxi11_call(vxi11_data->rpc_client, create_intr_chan,
+                    (xdrproc_t) xdr_Device_RemoteFunc, &remote_func,
+                    (xdrproc_t) xdr_Device_Error, &device_error, vxi11_data->timeout) != RPC_SUCCESS)
+                return -1;
+
+            if (device_error.error != 0)
             {
-                // Notify device found via callback
-                if (info->device != NULL)
-                    info->device(address, id);
+                error_printf("Interrupt channel error (response error code %d)\n", (int) device_error.error);
+                return -1;
             }
+
+            vxi11_data->intr_chan = true;
         }
-    } while (count > 0);
+    }
+    else if (!vxi11_data->intr_chan)
+    {
+        // Service requests were never enabled
+        return 0;
+    }
 
-    return 0;
+    // Enable or disable service requests tagged with session handle
+    srq_params.lid = vxi11_data->link_resp.lid;
+    srq_params.enable = (handler != NULL);
+    srq_params.handle.handle_len = sizeof(srq_handle);
+    srq_params.handle.handle_val = (char *) &srq_handle;
 
-socket_options_error:
-    // Shutdown socket
-    shutdown(sockfd, SHUT_RDWR);
+    if (vxi11_call(vxi11_data->rpc_client, device_enable_srq,
+            (xdrproc_t) xdr_Device_EnableSrqParms, &srq_params,
+            (xdrproc_t) xdr_Device_Error, &device_error, vxi11_data->timeout) != RPC_SUCCESS)
+        return -1;
 
-    return -1;
+    if (device_error.error != 0)
+    {
+        error_printf("Enable SRQ error (response error code %d)\n", (int) device_error.error);
+        return -1;
+    }
+
+    return 0;
 }
 
-int vxi11_discover(lxi_info_t *info, int timeout)
+static void generic_params(vxi11_data_t *vxi11_data, Device_GenericParms *generic_params, int timeout)
 {
-    struct sockaddr_in *broadcast_addr;
-    struct ifaddrs *ifap;
+    generic_params->lid = vxi11_data->link_resp.lid;
+    generic_params->flags = FLAG_WAIT_LOCK;
+    generic_params->lock_timeout = timeout;
+    generic_params->io_timeout = timeout;
+}
 
-    // Go through available broadcast addresses
-    if (getifaddrs(&ifap) == 0)
+int vxi11_read_stb(void *data, int timeout)
+{
+    Device_GenericParms params;
+    Device_ReadStbResp stb_resp;
+
+    vxi11_data_t *vxi11_data = (vxi11_data_t *) data;
+
+    generic_params(vxi11_data, &params, timeout);
+
+    if (vxi11_call(vxi11_data->rpc_client, device_readstb,
+            (xdrproc_t) xdr_Device_GenericParms, &params,
+            (xdrproc_t) xdr_Device_ReadStbResp, &stb_resp, timeout) != RPC_SUCCESS)
+        return -1;
+
+    if (stb_resp.error != 0)
     {
-        struct ifaddrs *ifap_p = ifap;
+        error_printf("Read status byte error (response error code %d)\n", (int) stb_resp.error);
+        return -1;
+    }
 
-        while (ifap_p)
-        {
-            if ((ifap_p->ifa_addr) && (ifap_p->ifa_broadaddr) && (ifap_p->ifa_addr->sa_family == AF_INET))
-            {
-                broadcast_addr = (struct sockaddr_in *) ifap_p->ifa_broadaddr;
+    // Return status byte
+    return stb_resp.stb;
+}
 
-                // Notify current broadcast address and network interface via callback
-                if ((info->broadcast != NULL) && (ifap_p->ifa_name != NULL))
-                    info->broadcast(inet_ntoa(broadcast_addr->sin_addr), ifap_p->ifa_name);
+int vxi11_trigger(void *data, int timeout, long long *sent)
+{
+    Device_GenericParms params;
+    Device_Error device_error;
 
-                // Find VXI11 devices via broadcast address
-                discover_devices(broadcast_addr, info, timeout);
+    vxi11_data_t *vxi11_data = (vxi11_data_t *) data;
 
-            }
-            ifap_p = ifap_p->ifa_next;
-        }
-        freeifaddrs(ifap);
+    generic_params(vxi11_data, &params, timeout);
+
+    if (sent != NULL)
+        *sent = session_time_ns();
+
+    if (vxi11_call(vxi11_data->rpc_client, device_trigger,
+            (xdrproc_t) xdr_Device_GenericParms, &params,
+            (xdrproc_t) xdr_Device_Error, &device_error, timeout) != RPC_SUCCESS)
+        return -1;
+
+    if (device_error.error != 0)
+    {
+        error_printf("Trigger error (response error code %d)\n", (int) device_error.error);
+        return -1;
     }
 
     return 0;
 }
 
-int vxi11_discover_if(lxi_info_t *info, const char *ifname, int timeout)
+int vxi11_clear(void *data, int timeout)
 {
-    struct sockaddr_in *broadcast_addr;
-    struct ifaddrs *ifap;
-    int status = 0;
+    Device_GenericParms params;
+    Device_Error device_error;
 
-    // Go through available broadcast addresses
-    if (getifaddrs(&ifap) == 0)
+    vxi11_data_t *vxi11_data = (vxi11_data_t *) data;
+
+    generic_params(vxi11_data, &params, timeout);
+
+    if (vxi11_call(vxi11_data->rpc_client, device_clear,
+            (xdrproc_t) xdr_Device_GenericParms, &params,
+            (xdrproc_t) xdr_Device_Error, &device_error, timeout) != RPC_SUCCESS)
+        return -1;
+
+    if (device_error.error != 0)
     {
-        struct ifaddrs *ifap_p = ifap;
+        error_printf("Clear error (response error code %d)\n", (int) device_error.error);
+        return -1;
+    }
 
-        while (ifap_p)
-        {
-            if ((ifap_p->ifa_addr) && (ifap_p->ifa_addr->sa_family == AF_INET) && (strcmp(ifap_p->ifa_name, ifname) == 0))
-            {
-                broadcast_addr = (struct sockaddr_in *) ifap_p->ifa_broadaddr;
+    return 0;
+}
 
-                // Notify current broadcast address and network interface via callback
-                if (info->broadcast != NULL)
-                    info->broadcast(inet_ntoa(broadcast_addr->sin_addr), ifap_p->ifa_name);
+int vxi11_remote(void *data, int timeout)
+{
+    Device_GenericParms params;
+    Device_Error device_error;
 
-                // Find VXI11 devices via broadcast address
-                status = discover_devices(broadcast_addr, info, timeout);
+    vxi11_data_t *vxi11_data = (vxi11_data_t *) data;
 
-            }
-            ifap_p = ifap_p->ifa_next;
-        }
-        freeifaddrs(ifap);
+    generic_params(vxi11_data, &params, timeout);
+
+    if (vxi11_call(vxi11_data->rpc_client, device_remote,
+            (xdrproc_t) xdr_Device_GenericParms, &params,
+            (xdrproc_t) xdr_Device_Error, &device_error, timeout) != RPC_SUCCESS)
+        return -1;
+
+    if (device_error.error != 0)
+    {
+        error_printf("Remote error (response error code %d)\n", (int) device_error.error);
+        return -1;
+    }
+
+    return 0;
+}
+
+int vxi11_local(void *data, int timeout)
+{
+    Device_GenericParms params;
+    Device_Error device_error;
+
+    vxi11_data_t *vxi11_data = (vxi11_data_t *) data;
+
+    generic_params(vxi11_data, &params, timeout);
+
+    if (vxi11_call(vxi11_data->rpc_client, device_local,
+            (xdrproc_t) xdr_Device_GenericParms, &params,
+            (xdrproc_t) xdr_Device_Error, &device_error, timeout) != RPC_SUCCESS)
+        return -1;
+
+    if (device_error.error != 0)
+    {
+        error_printf("Local error (response error code %d)\n", (int) device_error.error);
+        return -1;
+    }
+
+    return 0;
+}
+
+int vxi11_lock(void *data, int timeout)
+{
+    Device_LockParms lock_params;
+    Device_Error device_error;
+
+    vxi11_data_t *vxi11_data = (vxi11_data_t *) data;
+
+    // Let device wait for lock to be released by other links
+    lock_params.lid = vxi11_data->link_resp.lid;
+    lock_params.flags = FLAG_WAIT_LOCK;
+    lock_params.lock_timeout = timeout;
+
+    if (vxi11_call(vxi11_data->rpc_client, device_lock,
+            (xdrproc_t) xdr_Device_LockParms, &lock_params,
+            (xdrproc_t) xdr_Device_Error, &device_error, timeout) != RPC_SUCCESS)
+        return -1;
+
+    if (device_error.error != 0)
+    {
+        if (device_error.error == 11)
+            error_printf("Lock error (device locked by another link)\n");
+        else
+            error_printf("Lock error (response error code %d)\n", (int) device_error.error);
+        return -1;
+    }
+
+    return 0;
+}
+
+int vxi11_unlock(void *data)
+{
+    Device_Error device_error;
+
+    vxi11_data_t *vxi11_data = (vxi11_data_t *) data;
+
+    if (vxi11_call(vxi11_data->rpc_client, device_unlock,
+            (xdrproc_t) xdr_Device_Link, &vxi11_data->link_resp.lid,
+            (xdrproc_t) xdr_Device_Error, &device_error, vxi11_data->timeout) != RPC_SUCCESS)
+        return -1;
+
+    if (device_error.error != 0)
+    {
+        if (device_error.error == 12)
+            error_printf("Unlock error (no lock held by this link)\n");
+        else
+            error_printf("Unlock error (response error code %d)\n", (int) device_error.error);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int get_device_id(const char *address, lxi_protocol_t protocol, int port, char *id, int size, int timeout)
+{
+    const identify_ops_t *ops = &identify_ops[protocol];
+    union
+    {
+        vxi11_data_t vxi11;
+        tcp_data_t tcp;
+        hislip_data_t hislip;
+    } data;
+    int length;
+    int device;
+
+    memset(&data, 0, sizeof(data));
+
+    device = ops->connect(&data, address, port, NULL, timeout);
+    if (device < 0)
+        goto error_connect;
+
+    length = ops->send(&data, ID_REQ_SCPI, strlen(ID_REQ_SCPI), timeout);
+    if (length < 0)
+        goto error_send;
+
+    // Leave room for string termination
+    length = ops->receive(&data, id, size - 1, timeout);
+    if (length < 0)
+        goto error_receive;
+
+    ops->disconnect(&data);
+
+    // Terminate string
+    id[length] = 0;
+
+    if (length > 0)
+    {
+        // Strip newline
+        if (id[length-1] == '\n')
+            id[--length] = 0;
+
+        // Strip carriage return
+        if (id[length-1] == '\r')
+            id[--length] = 0;
+    } else
+    {
+        // Fallback - try retrieve ID via HTTP/XML
+        identification_t identification;
+
+        if (identify_http(address, &identification, timeout) != 0)
+            return -1;
+
+        snprintf(id, size, "%s,%s,%s,%s", identification.manufacturer, identification.model,
+                identification.serial_number, identification.firmware_revision);
+    }
+
+    return 0;
+
+error_receive:
+error_send:
+    ops->disconnect(&data);
+error_connect:
+    return -1;
+}
+
+static void discover_job_identify(discover_job_t *job, int timeout)
+{
+    // VXI-11 core channel is located via portmapper again when connecting
+    job->status = get_device_id(job->address, job->protocol, (job->protocol == VXI11) ? 0 : job->port,
+            job->id, sizeof(job->id), timeout);
+}
+
+static void *thread_discover_worker(void *ptr)
+{
+    discover_pool_t *pool = (discover_pool_t *) ptr;
+    discover_job_t *job;
+    char wakeup = 0;
+
+    pthread_mutex_lock(&pool->mutex);
+
+    for (;;)
+    {
+        // Wait for device to identify
+        pool->idle++;
+        while ((pool->queue == NULL) && !pool->closing)
+            pthread_cond_wait(&pool->cond, &pool->mutex);
+        pool->idle--;
+
+        if (pool->queue == NULL)
+            break;
+
+        job = pool->queue;
+        pool->queue = job->next;
+        pthread_mutex_unlock(&pool->mutex);
+
+        discover_job_identify(job, pool->timeout);
+
+        // Hand result back to discovering thread
+        pthread_mutex_lock(&pool->mutex);
+        job->next = pool->done;
+        pool->done = job;
+        write(pool->wakeup[1], &wakeup, 1);
+    }
+
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+static int discover_pool_submit(discover_pool_t *pool, const char *address, lxi_protocol_t protocol, unsigned short port)
+{
+    discover_job_t *job, **tail;
+
+    job = calloc(1, sizeof(discover_job_t));
+    if (job == NULL)
+        return -1;
+
+    strncpy(job->address, address, sizeof(job->address) - 1);
+    job->protocol = protocol;
+    job->port = port;
+
+    pthread_mutex_lock(&pool->mutex);
+
+    // Queue in order of response
+    for (tail = &pool->queue; *tail != NULL; tail = &(*tail)->next)
+        ;
+    *tail = job;
+
+    // Add worker if all are busy
+    if ((pool->idle == 0) && (pool->workers < DISCOVER_WORKERS_MAX))
+    {
+        if (pthread_create(&pool->threads[pool->workers], NULL, thread_discover_worker, pool) == 0)
+            pool->workers++;
+    }
+
+    // Identify in calling thread as last resort
+    if (pool->workers == 0)
+    {
+        pool->queue = NULL;
+        pthread_mutex_unlock(&pool->mutex);
+        discover_job_identify(job, pool->timeout);
+        pthread_mutex_lock(&pool->mutex);
+        job->next = pool->done;
+        pool->done = job;
+    }
+    else
+        pthread_cond_signal(&pool->cond);
+
+    pthread_mutex_unlock(&pool->mutex);
+
+    return 0;
+}
+
+static int discover_cache_find(discover_cache_t *cache, struct in_addr address)
+{
+    int i;
+
+    for (i = 0; i < cache->count; i++)
+    {
+        if (cache->entries[i].address == address.s_addr)
+            return i;
+    }
+
+    return -1;
+}
+
+// Remember device responding with its current identification
+static void discover_cache_update(discover_cache_t *cache, struct in_addr address, const char *id,
+                                  unsigned short port, bool identified)
+{
+    cache_entry_t *entries;
+    bool *reported;
+    int i;
+
+    // Too long to cache, identified again next time
+    if (strlen(id) >= CACHE_ID_LENGTH_MAX)
+        return;
+
+    i = discover_cache_find(cache, address);
+    if (i < 0)
+    {
+        entries = realloc(cache->entries, (cache->count + 1) * sizeof(cache_entry_t));
+        if (entries == NULL)
+            return;
+        cache->entries = entries;
+
+        reported = realloc(cache->reported, (cache->count + 1) * sizeof(bool));
+        if (reported == NULL)
+            return;
+        cache->reported = reported;
+
+        i = cache->count++;
+        memset(&cache->entries[i], 0, sizeof(cache_entry_t));
+        cache->entries[i].address = address.s_addr;
+    }
+
+    cache->entries[i].port = port;
+    cache->entries[i].missed = 0;
+    cache->entries[i].last_seen = time(NULL);
+    if (identified)
+        cache->entries[i].identified = cache->entries[i].last_seen;
+    if (cache->entries[i].id != id)
+        strcpy(cache->entries[i].id, id);
+    cache->reported[i] = true;
+}
+
+// Notify identified devices, returns number of jobs completed
+static int discover_pool_deliver(discover_pool_t *pool, discover_cache_t *cache, lxi_info_t *info)
+{
+    struct in_addr address;
+    discover_job_t *job, *done;
+    char buffer[64];
+    int count = 0;
+    bool cached;
+    int known;
+
+    // Drain wakeups
+    while (read(pool->wakeup[0], buffer, sizeof(buffer)) > 0)
+        ;
+
+    pthread_mutex_lock(&pool->mutex);
+    done = pool->done;
+    pool->done = NULL;
+    pthread_mutex_unlock(&pool->mutex);
+
+    while (done != NULL)
+    {
+        job = done;
+        done = job->next;
+
+        // Notify device found via callback
+        if (job->status == 0)
+        {
+            // Cache keeps track of VXI-11 core channels only
+            cached = (job->protocol == VXI11) && (inet_aton(job->address, &address) != 0);
+            known = cached ? discover_cache_find(cache, address) : -1;
+
+            // Device identified again is reported again only if it changed
+            if ((known < 0) || !cache->reported[known] || (strcmp(cache->entries[known].id, job->id) != 0))
+            {
+                if ((info->device != NULL) && !until_reached())
+                    info->device(job->address, job->id);
+            }
+
+            if (cached)
+                discover_cache_update(cache, address, job->id, job->port, true);
+        }
+
+        free(job);
+        count++;
+    }
+
+    return count;
+}
+
+static bool address_seen(struct in_addr *seen, int count, struct in_addr address)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        if (seen[i].s_addr == address.s_addr)
+            return true;
+    }
+
+    return false;
+}
+
+// Port of core channel in portmapper GETPORT reply, 0 if not registered
+static unsigned short getport_reply_port(const char *buffer, int count)
+{
+    uint32_t value;
+
+    if (count < REPLY_PORT_OFFSET + 4)
+        return 0;
+
+    memcpy(&value, buffer + REPLY_PORT_OFFSET, sizeof(value));
+
+    return (unsigned short) ntohl(value);
+}
+
+static int discover_socket(bool broadcast)
+{
+    struct sockaddr_in send_addr;
+    int enable = broadcast;
+    int sockfd;
+
+    // Create a socket
+    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd == -1)
+    {
+        error_printf("Socket creation error");
+        return -1;
+    }
+
+    // Set socket options - broadcast
+    if((setsockopt(sockfd, SOL_SOCKET, SO_BROADCAST,
+                    &enable,sizeof (enable))) == -1)
+    {
+        error_printf("setsockopt - SO_SOCKET");
+        close(sockfd);
+        return -1;
+    }
+
+    // Senders address
+    send_addr.sin_family = AF_INET;
+    send_addr.sin_addr.s_addr = INADDR_ANY;
+    send_addr.sin_port = 0;     // 0 = random sender port
+
+    // Bind socket to address
+    bind(sockfd, (struct sockaddr*)&send_addr, sizeof(send_addr));
+
+    return sockfd;
+}
+
+// Set up worker pool and load cache shared by all ways of discovering
+static int discover_start(discover_t *discover, lxi_info_t *info, int timeout)
+{
+    memset(discover, 0, sizeof(discover_t));
+    discover->info = info;
+
+    // Set up pool of workers identifying devices, woken up via pipe
+    if (pipe(discover->pool.wakeup) != 0)
+    {
+        error_printf("%s\n", strerror(errno));
+        return -1;
+    }
+    fcntl(discover->pool.wakeup[0], F_SETFL, O_NONBLOCK);
+    pthread_mutex_init(&discover->pool.mutex, NULL);
+    pthread_cond_init(&discover->pool.cond, NULL);
+    discover->pool.timeout = timeout;
+
+    // Devices known from previous discoveries
+    discover->cache.count = cache_load(&discover->cache.entries);
+    if (discover->cache.count > 0)
+    {
+        discover->cache.reported = calloc(discover->cache.count, sizeof(bool));
+        if (discover->cache.reported == NULL)
+        {
+            free(discover->cache.entries);
+            discover->cache.entries = NULL;
+            discover->cache.count = 0;
+        }
+    }
+
+    return 0;
+}
+
+static void discover_finish(discover_t *discover)
+{
+    discover_pool_t *pool = &discover->pool;
+    discover_job_t *job;
+    int i;
+
+    // Stop workers
+    pthread_mutex_lock(&pool->mutex);
+    pool->closing = true;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+    for (i = 0; i < pool->workers; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    // Release any results not delivered
+    while (pool->done != NULL)
+    {
+        job = pool->done;
+        pool->done = job->next;
+        free(job);
+    }
+    while (pool->queue != NULL)
+    {
+        job = pool->queue;
+        pool->queue = job->next;
+        free(job);
+    }
+
+    // Save outcome for next discovery
+    if (discover->cache.count > 0)
+        cache_store(discover->cache.entries, discover->cache.count);
+    free(discover->cache.entries);
+    free(discover->cache.reported);
+
+    free(discover->seen);
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->mutex);
+    close(pool->wakeup[0]);
+    close(pool->wakeup[1]);
+}
+
+static void discover_deliver(discover_t *discover)
+{
+    discover->outstanding -= discover_pool_deliver(&discover->pool, &discover->cache, discover->info);
+}
+
+static bool identification_fresh(cache_entry_t *entry)
+{
+    int64_t age = time(NULL) - entry->identified;
+
+    // Clock set back counts as stale too
+    return (age >= 0) && (age < CACHE_ID_AGE_MAX);
+}
+
+// Have responding device identified unless already done
+static void discover_response(discover_t *discover, struct in_addr address, lxi_protocol_t protocol, unsigned short port)
+{
+    discover_cache_t *cache = &discover->cache;
+    struct in_addr *seen;
+    int known;
+
+    // Identify each responder once, also when reachable via several interfaces
+    if (address_seen(discover->seen, discover->seen_count, address))
+        return;
+
+    seen = realloc(discover->seen, (discover->seen_count + 1) * sizeof(struct in_addr));
+    if (seen == NULL)
+        return;
+    discover->seen = seen;
+    discover->seen[discover->seen_count++] = address;
+
+    // Known device still serving on same port is assumed unchanged for a
+    // while, then identified again in case it was replaced by another one
+    known = discover_cache_find(cache, address);
+    if ((protocol == VXI11) && (known >= 0) && (cache->entries[known].port == port) &&
+        identification_fresh(&cache->entries[known]))
+    {
+        if (!cache->reported[known] && (discover->info->device != NULL) && !until_reached())
+            discover->info->device(inet_ntoa(address), cache->entries[known].id);
+        discover_cache_update(cache, address, cache->entries[known].id, port, false);
+        return;
+    }
+
+    if (discover_pool_submit(&discover->pool, inet_ntoa(address), protocol, port) == 0)
+        discover->outstanding++;
+
+    // Identified in this thread if no worker could be started
+    discover_deliver(discover);
+}
+
+// Cache is shared by all interfaces, interface scoped discovery only uses entries on its networks
+static bool discover_in_scope(struct in_addr *broadcast_addrs, struct in_addr *netmasks, int broadcast_count,
+                              uint32_t address)
+{
+    int i;
+
+    if (netmasks == NULL)
+        return true;
+
+    for (i = 0; i < broadcast_count; i++)
+    {
+        if ((address & netmasks[i].s_addr) == (broadcast_addrs[i].s_addr & netmasks[i].s_addr))
+            return true;
+    }
+
+    return false;
+}
+
+static int discover_devices(struct in_addr *broadcast_addrs, struct in_addr *netmasks, int broadcast_count,
+                            lxi_info_t *info, int timeout)
+{
+    struct sockaddr_in recv_addr;
+    int sockfd;
+    int count;
+    char buffer[REPLY_LENGTH_MAX];
+    socklen_t addrlen;
+    discover_t discover;
+    discover_cache_t *cache = &discover.cache;
+    struct pollfd *pfd;
+    bool *in_scope = NULL;
+    int nfds = 1;
+    bool listening = true;
+    long long deadline;
+    int i;
+
+    // One wakeup descriptor, one socket per broadcast address and one for probing known devices
+    pfd = calloc(broadcast_count + 2, sizeof(struct pollfd));
+    if (pfd == NULL)
+    {
+        error_printf("%s\n", strerror(errno));
+        return -1;
+    }
+
+    if (discover_start(&discover, info, timeout) != 0)
+    {
+        free(pfd);
+        return -1;
+    }
+
+    pfd[0].fd = discover.pool.wakeup[0];
+    pfd[0].events = POLLIN;
+
+    if (cache->count > 0)
+    {
+        // Without scope of entries known the cache is left untouched
+        in_scope = calloc(cache->count, sizeof(bool));
+        if (in_scope == NULL)
+            cache->count = 0;
+    }
+
+    // Report devices known from previous discoveries right away
+    for (i = 0; i < cache->count; i++)
+    {
+        in_scope[i] = discover_in_scope(broadcast_addrs, netmasks, broadcast_count, cache->entries[i].address);
+        if (!in_scope[i])
+            continue;
+
+        // Devices which failed to respond last time are reported once confirmed
+        if ((cache->entries[i].missed == 0) && !until_reached())
+        {
+            if (info->device != NULL)
+            {
+                recv_addr.sin_addr.s_addr = cache->entries[i].address;
+                info->device(inet_ntoa(recv_addr.sin_addr), cache->entries[i].id);
+            }
+            cache->reported[i] = true;
+        }
+
+        // Cleared again when device responds
+        cache->entries[i].missed++;
+    }
+
+    // Device looked for may be known already
+    if (until_reached())
+        goto finish;
+
+    // Receivers address
+    recv_addr.sin_family = AF_INET;
+    recv_addr.sin_port = htons(PORT_RPC);
+
+    // Broadcast RPC GETPORT message on all interfaces up front
+    for (i = 0; i < broadcast_count; i++)
+    {
+        sockfd = discover_socket(true);
+        if (sockfd < 0)
+            continue;
+
+        recv_addr.sin_addr = broadcast_addrs[i];
+
+        if (sendto(sockfd, rpc_GETPORT_msg, sizeof(rpc_GETPORT_msg), 0,
+                    (struct sockaddr*)&recv_addr, sizeof(recv_addr)) < 0)
+        {
+            close(sockfd);
+            continue;
+        }
+
+        pfd[nfds].fd = sockfd;
+        pfd[nfds].events = POLLIN;
+        nfds++;
+    }
+
+    // Probe known devices directly, also when not reachable by broadcast
+    if ((cache->count > 0) && ((sockfd = discover_socket(false)) >= 0))
+    {
+        for (i = 0; i < cache->count; i++)
+        {
+            if (!in_scope[i])
+                continue;
+            recv_addr.sin_addr.s_addr = cache->entries[i].address;
+            sendto(sockfd, rpc_GETPORT_msg, sizeof(rpc_GETPORT_msg), 0,
+                    (struct sockaddr*)&recv_addr, sizeof(recv_addr));
+        }
+
+        pfd[nfds].fd = sockfd;
+        pfd[nfds].events = POLLIN;
+        nfds++;
+    }
+
+    // Listen for responses until none arrive within timeout
+    deadline = time_ms() + timeout;
+    if (nfds == 1)
+        listening = false;
+
+    // Go through received responses while identifying responders concurrently
+    while ((listening || (discover.outstanding > 0)) && !until_reached())
+    {
+        long long remaining = deadline - time_ms();
+
+        if (listening && (remaining <= 0))
+        {
+            listening = false;
+            continue;
+        }
+
+        if (poll(pfd, listening ? nfds : 1, listening ? (int) remaining : -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            error_printf("%s\n", strerror(errno));
+            break;
+        }
+
+        if (pfd[0].revents & POLLIN)
+            discover_deliver(&discover);
+
+        for (i = 1; listening && (i < nfds); i++)
+        {
+            if (!(pfd[i].revents & POLLIN))
+                continue;
+
+            addrlen = sizeof(recv_addr);
+            count = recvfrom(pfd[i].fd, buffer, sizeof(buffer), 0,
+                    (struct sockaddr*)&recv_addr, &addrlen);
+            if (count <= 0)
+                continue;
+
+            deadline = time_ms() + timeout;
+
+            discover_response(&discover, recv_addr.sin_addr, VXI11, getport_reply_port(buffer, count));
+        }
+    }
+
+finish:
+    // Devices not heard from when stopping early have not been missed
+    if (until_reached())
+    {
+        for (i = 0; i < cache->count; i++)
+        {
+            if (in_scope[i] && (cache->entries[i].missed > 0))
+                cache->entries[i].missed--;
+        }
+    }
+
+    discover_finish(&discover);
+
+    for (i = 1; i < nfds; i++)
+        close(pfd[i].fd);
+
+    free(in_scope);
+    free(pfd);
+
+    return 0;
+}
+
+// Collect IPv4 broadcast addresses of all interfaces or only the named one, with netmasks if wanted
+static int broadcast_addresses(lxi_info_t *info, const char *ifname, struct in_addr **addrs,
+                               struct in_addr **netmasks)
+{
+    struct sockaddr_in *broadcast_addr;
+    struct ifaddrs *ifap, *ifap_p;
+    struct in_addr *addrs_new;
+    int count = 0;
+    int i;
+
+    *addrs = NULL;
+    if (netmasks != NULL)
+        *netmasks = NULL;
+
+    if (getifaddrs(&ifap) != 0)
+        return 0;
+
+    // Go through available broadcast addresses
+    for (ifap_p = ifap; ifap_p != NULL; ifap_p = ifap_p->ifa_next)
+    {
+        if ((ifap_p->ifa_addr == NULL) || (ifap_p->ifa_broadaddr == NULL) ||
+            (ifap_p->ifa_addr->sa_family != AF_INET))
+            continue;
+
+        if ((ifname != NULL) && ((ifap_p->ifa_name == NULL) || (strcmp(ifap_p->ifa_name, ifname) != 0)))
+            continue;
+
+        broadcast_addr = (struct sockaddr_in *) ifap_p->ifa_broadaddr;
+
+        // Notify current broadcast address and network interface via callback
+        if ((info->broadcast != NULL) && (ifap_p->ifa_name != NULL))
+            info->broadcast(inet_ntoa(broadcast_addr->sin_addr), ifap_p->ifa_name);
+
+        // Broadcast once per address
+        for (i = 0; i < count; i++)
+        {
+            if ((*addrs)[i].s_addr == broadcast_addr->sin_addr.s_addr)
+                break;
+        }
+        if (i < count)
+            continue;
+
+        addrs_new = realloc(*addrs, (count + 1) * sizeof(struct in_addr));
+        if (addrs_new == NULL)
+            break;
+        *addrs = addrs_new;
+        (*addrs)[count] = broadcast_addr->sin_addr;
+
+        if (netmasks != NULL)
+        {
+            addrs_new = realloc(*netmasks, (count + 1) * sizeof(struct in_addr));
+            if (addrs_new == NULL)
+                break;
+            *netmasks = addrs_new;
+            (*netmasks)[count].s_addr = (ifap_p->ifa_netmask != NULL) ?
+                ((struct sockaddr_in *) ifap_p->ifa_netmask)->sin_addr.s_addr : INADDR_NONE;
+        }
+        count++;
     }
 
+    freeifaddrs(ifap);
+
+    return count;
+}
+
+int vxi11_discover(lxi_info_t *info, int timeout)
+{
+    struct in_addr *addrs;
+    int count;
+
+    // Find VXI11 devices via all broadcast addresses at once
+    count = broadcast_addresses(info, NULL, &addrs, NULL);
+    if (count > 0)
+        discover_devices(addrs, NULL, count, info, timeout);
+    free(addrs);
+
+    return 0;
+}
+
+int vxi11_discover_if(lxi_info_t *info, const char *ifname, int timeout)
+{
+    struct in_addr *addrs, *netmasks;
+    int count;
+    int status = 0;
+
+    // Find VXI11 devices via broadcast addresses of interface
+    count = broadcast_addresses(info, ifname, &addrs, &netmasks);
+    if (count > 0)
+        status = discover_devices(addrs, netmasks, count, info, timeout);
+    free(addrs);
+    free(netmasks);
+
+    return status;
+}
+
+// Parse list of addresses in CIDR notation, returns total number of hosts
+static long sweep_ranges(const char *ranges, sweep_range_t **list, int *count)
+{
+    sweep_range_t *list_new;
+    char *copy, *token, *saveptr, *prefix, *end;
+    struct in_addr address;
+    uint32_t network, mask;
+    long bits, total = 0;
+
+    *list = NULL;
+    *count = 0;
+
+    copy = strdup(ranges);
+    if (copy == NULL)
+        return -1;
+
+    for (token = strtok_r(copy, ", \t\n", &saveptr); token != NULL; token = strtok_r(NULL, ", \t\n", &saveptr))
+    {
+        // Single address unless prefix length given
+        bits = 32;
+        prefix = strchr(token, '/');
+        if (prefix != NULL)
+        {
+            bits = strtol(prefix + 1, &end, 10);
+            if ((end == prefix + 1) || (*end != 0) || (bits < 0) || (bits > 32))
+                goto error_range;
+            *prefix = 0;
+        }
+
+        if (inet_pton(AF_INET, token, &address) != 1)
+        {
+            if (prefix != NULL)
+                *prefix = '/';
+            goto error_range;
+        }
+
+        list_new = realloc(*list, (*count + 1) * sizeof(sweep_range_t));
+        if (list_new == NULL)
+            goto error_alloc;
+        *list = list_new;
+
+        mask = (bits == 0) ? 0 : 0xffffffff << (32 - bits);
+        network = ntohl(address.s_addr) & mask;
+
+        // Skip network and broadcast addresses unless point-to-point or single host
+        if (bits <= 30)
+        {
+            (*list)[*count].first = network + 1;
+            (*list)[*count].count = ~mask - 1;
+        }
+        else
+        {
+            (*list)[*count].first = network;
+            (*list)[*count].count = ~mask + 1;
+        }
+
+        total += (*list)[*count].count;
+        (*count)++;
+
+        if (total > SWEEP_HOSTS_MAX)
+        {
+            error_printf("Address ranges too large (more than %d hosts)\n", SWEEP_HOSTS_MAX);
+            goto error_alloc;
+        }
+    }
+
+    free(copy);
+
+    return total;
+
+error_range:
+    error_printf("Invalid address range (%s)\n", token);
+error_alloc:
+    free(copy);
+    free(*list);
+    *list = NULL;
+    *count = 0;
+    return -1;
+}
+
+// Host at position in ranges, also used to match replies to probes
+static struct in_addr sweep_host(sweep_range_t *ranges, int count, uint32_t index)
+{
+    struct in_addr address;
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        if (index < ranges[i].count)
+            break;
+        index -= ranges[i].count;
+    }
+
+    address.s_addr = htonl(ranges[i].first + index);
+
+    return address;
+}
+
+static int sweep_connect(sweep_connect_t *probe, struct in_addr address, lxi_protocol_t protocol,
+        unsigned short port, long long deadline)
+{
+    struct sockaddr_in server_addr;
+    struct linger linger = { .l_onoff = 1, .l_linger = 0 };
+    int sockfd;
+
+    sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sockfd < 0)
+        return -1;
+
+    // Reset connection on close so probing leaves no state behind on device
+    setsockopt(sockfd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    server_addr.sin_addr = address;
+
+    if ((connect(sockfd, (struct sockaddr *) &server_addr, sizeof(server_addr)) < 0) && (errno != EINPROGRESS))
+    {
+        close(sockfd);
+        return -1;
+    }
+
+    probe->fd = sockfd;
+    probe->address = address;
+    probe->protocol = protocol;
+    probe->port = port;
+    probe->deadline = deadline;
+
+    return 0;
+}
+
+static int sweep_devices(sweep_range_t *ranges, int range_count, uint32_t total, lxi_info_t *info,
+        int rate, int timeout, bool tcp)
+{
+    struct sockaddr_in recv_addr;
+    sweep_connect_t *probes;
+    struct pollfd *pfd;
+    char message[sizeof(rpc_GETPORT_msg)];
+    char buffer[REPLY_LENGTH_MAX];
+    discover_t discover;
+    socklen_t addrlen;
+    struct in_addr address;
+    uint32_t xid_base, xid, next = 0;
+    unsigned short port;
+    long long start, now, due, deadline = 0, packets = 0;
+    int probe_count = 0;
+    int status = -1;
+    int sockfd;
+    int count;
+    int error;
+    int wait;
+    int i;
+
+    // Wakeup descriptor, probe socket and connections in flight
+    probes = calloc(SWEEP_CONNECTS_MAX, sizeof(sweep_connect_t));
+    pfd = calloc(2 + SWEEP_CONNECTS_MAX, sizeof(struct pollfd));
+    if ((probes == NULL) || (pfd == NULL))
+    {
+        error_printf("%s\n", strerror(errno));
+        goto error_alloc;
+    }
+
+    // All probes go out and all replies come back via a single socket
+    sockfd = discover_socket(false);
+    if (sockfd < 0)
+        goto error_alloc;
+    fcntl(sockfd, F_SETFL, O_NONBLOCK);
+
+    if (discover_start(&discover, info, timeout) != 0)
+        goto error_start;
+
+    pfd[0].fd = discover.pool.wakeup[0];
+    pfd[0].events = POLLIN;
+    pfd[1].fd = sockfd;
+    pfd[1].events = POLLIN;
+
+    // Transaction ID tells which host a reply belongs to
+    xid_base = (uint32_t) time_ms() ^ ((uint32_t) getpid() << 16);
+    memcpy(message, rpc_GETPORT_msg, sizeof(message));
+
+    recv_addr.sin_family = AF_INET;
+    recv_addr.sin_port = htons(PORT_RPC);
+
+    start = time_ms();
+
+    for (;;)
+    {
+        now = time_ms();
+
+        // Send probes due by now at configured rate
+        while ((next < total) && (packets < (now - start) * rate / 1000 + 1))
+        {
+            if (tcp && (probe_count + 2 > SWEEP_CONNECTS_MAX))
+                break;
+
+            address = sweep_host(ranges, range_count, next);
+
+            xid = htonl(xid_base + next);
+            memcpy(message, &xid, sizeof(xid));
+            recv_addr.sin_addr = address;
+            sendto(sockfd, message, sizeof(message), 0, (struct sockaddr *) &recv_addr, sizeof(recv_addr));
+            packets++;
+
+            // Look for instruments serving SCPI without VXI-11
+            if (tcp)
+            {
+                if (sweep_connect(&probes[probe_count], address, RAW, PORT_RAW, now + timeout) == 0)
+                    probe_count++;
+                if (sweep_connect(&probes[probe_count], address, HISLIP, PORT_HISLIP, now + timeout) == 0)
+                    probe_count++;
+                packets += 2;
+            }
+
+            if (++next == total)
+                deadline = now + timeout;
+        }
+
+        // Done when all probes are answered or timed out and responders identified
+        if ((next == total) && (now >= deadline) && (probe_count == 0) && (discover.outstanding == 0))
+            break;
+
+        // Wake up for next probe, end of listening or first connection timing out
+        wait = -1;
+        if ((next < total) && (!tcp || (probe_count + 2 <= SWEEP_CONNECTS_MAX)))
+        {
+            due = start + (packets * 1000) / rate;
+            wait = (due > now) ? (int) (due - now) : 0;
+        }
+        else if ((next == total) && (now < deadline))
+            wait = (int) (deadline - now);
+        for (i = 0; i < probe_count; i++)
+        {
+            if ((wait < 0) || (probes[i].deadline - now < wait))
+                wait = (probes[i].deadline > now) ? (int) (probes[i].deadline - now) : 0;
+
+            pfd[2 + i].fd = probes[i].fd;
+            pfd[2 + i].events = POLLOUT;
+            pfd[2 + i].revents = 0;
+        }
+
+        if (poll(pfd, 2 + probe_count, wait) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            error_printf("%s\n", strerror(errno));
+            break;
+        }
+
+        if (pfd[0].revents & POLLIN)
+            discover_deliver(&discover);
+
+        // Accept replies matching a probe sent
+        while (pfd[1].revents & POLLIN)
+        {
+            addrlen = sizeof(recv_addr);
+            count = recvfrom(sockfd, buffer, sizeof(buffer), 0, (struct sockaddr *) &recv_addr, &addrlen);
+            if (count <= 0)
+                break;
+
+            if (count < (int) sizeof(xid))
+                continue;
+            memcpy(&xid, buffer, sizeof(xid));
+            xid = ntohl(xid) - xid_base;
+            if ((xid >= next) || (sweep_host(ranges, range_count, xid).s_addr != recv_addr.sin_addr.s_addr))
+                continue;
+
+            // Portmapper without VXI-11 core channel is not an instrument
+            port = getport_reply_port(buffer, count);
+            if (port == 0)
+                continue;
+
+            discover_response(&discover, recv_addr.sin_addr, VXI11, port);
+        }
+
+        // Connections accepted reveal instruments, refused or timed out do not
+        now = time_ms();
+        for (i = probe_count - 1; i >= 0; i--)
+        {
+            if (pfd[2 + i].revents != 0)
+            {
+                addrlen = sizeof(error);
+                if ((getsockopt(probes[i].fd, SOL_SOCKET, SO_ERROR, &error, &addrlen) == 0) && (error == 0))
+                    discover_response(&discover, probes[i].address, probes[i].protocol, probes[i].port);
+            }
+            else if (now < probes[i].deadline)
+                continue;
+
+            close(probes[i].fd);
+            probes[i] = probes[--probe_count];
+            pfd[2 + i] = pfd[2 + probe_count];
+        }
+    }
+
+    for (i = 0; i < probe_count; i++)
+        close(probes[i].fd);
+
+    discover_finish(&discover);
+    status = 0;
+
+error_start:
+    close(sockfd);
+error_alloc:
+    free(probes);
+    free(pfd);
+
+    return status;
+}
+
+int vxi11_discover_sweep(lxi_info_t *info, const char *ranges, int rate, int timeout, bool tcp)
+{
+    sweep_range_t *list;
+    int count;
+    long total;
+    int status;
+
+    total = sweep_ranges(ranges, &list, &count);
+    if (total < 0)
+        return -1;
+
+    if (rate <= 0)
+        rate = SWEEP_RATE_DEFAULT;
+
+    // Find VXI11 devices by asking each host directly
+    status = 0;
+    if (total > 0)
+        status = sweep_devices(list, count, total, info, rate, timeout, tcp);
+    free(list);
+
     return status;
 }
@@ -31,6 +31,9 @@
 #ifndef VXI11_H
 #define VXI11_H
 
+#include <stdbool.h>
+#include <pthread.h>
+#include <netinet/in.h>
 #include "vxi11core.h"
 #include <lxi.h>
 
@@ -38,13 +41,31 @@ typedef struct
 {
     CLIENT *rpc_client;
     Create_LinkResp link_resp;
+    struct sockaddr_in server_addr;
+    struct sockaddr_in client_addr;
+    int timeout;
+    int termchar;
+    CLIENT *abort_client;
+    pthread_mutex_t abort_mutex;
+    bool intr_chan;
 } vxi11_data_t;
 
 int vxi11_connect(void *data, const char *address, int port, const char *name, int timeout);
 int vxi11_disconnect(void *data);
 int vxi11_send(void *data, const char *message, int length, int timeout);
 int vxi11_receive(void *data, char *message, int length, int timeout);
+int vxi11_set_termchar(void *data, int termchar);
+int vxi11_abort(void *data);
+int vxi11_read_stb(void *data, int timeout);
+int vxi11_trigger(void *data, int timeout, long long *sent);
+int vxi11_clear(void *data, int timeout);
+int vxi11_remote(void *data, int timeout);
+int vxi11_local(void *data, int timeout);
+int vxi11_lock(void *data, int timeout);
+int vxi11_unlock(void *data);
+int vxi11_enable_srq(void *data, int handle, void (*handler)(int handle));
 int vxi11_discover(lxi_info_t *info, int timeout);
 int vxi11_discover_if(lxi_info_t *info, const char *ifname, int timeout);
+int vxi11_discover_sweep(lxi_info_t *info, const char *ranges, int rate, int timeout, bool tcp);
 
 #endif
@@ -150,6 +150,14 @@ struct Device_DocmdResp {
 };
 typedef struct Device_DocmdResp Device_DocmdResp;
 
+struct Device_SrqParms {
+	struct {
+		u_int handle_len;
+		char *handle_val;
+	} handle;
+};
+typedef struct Device_SrqParms Device_SrqParms;
+
 #define DEVICE_ASYNC 0x0607B0
 #define DEVICE_ASYNC_VERSION 1
 
@@ -266,6 +274,22 @@ extern  bool_t destroy_intr_chan_1_svc();
 extern int device_core_1_freeresult ();
 #endif /* K&R C */
 
+#define DEVICE_INTR 0x0607B1
+#define DEVICE_INTR_VERSION 1
+
+#if defined(__STDC__) || defined(__cplusplus)
+#define device_intr_srq 30
+extern  enum clnt_stat device_intr_srq_1(Device_SrqParms *, void *, CLIENT *);
+extern  bool_t device_intr_srq_1_svc(Device_SrqParms *, void *, struct svc_req *);
+extern int device_intr_1_freeresult (SVCXPRT *, xdrproc_t, caddr_t);
+
+#else /* K&R C */
+#define device_intr_srq 30
+extern  enum clnt_stat device_intr_srq_1();
+extern  bool_t device_intr_srq_1_svc();
+extern int device_intr_1_freeresult ();
+#endif /* K&R C */
+
 /* the xdr functions */
 
 #if defined(__STDC__) || defined(__cplusplus)
@@ -287,6 +311,7 @@ extern  bool_t xdr_Device_EnableSrqParms (XDR *, Device_EnableSrqParms*);
 extern  bool_t xdr_Device_LockParms (XDR *, Device_LockParms*);
 extern  bool_t xdr_Device_DocmdParms (XDR *, Device_DocmdParms*);
 extern  bool_t xdr_Device_DocmdResp (XDR *, Device_DocmdResp*);
+extern  bool_t xdr_Device_SrqParms (XDR *, Device_SrqParms*);
 
 #else /* K&R C */
 extern bool_t xdr_Device_Link ();
@@ -307,6 +332,7 @@ extern bool_t xdr_Device_EnableSrqParms ();
 extern bool_t xdr_Device_LockParms ();
 extern bool_t xdr_Device_DocmdParms ();
 extern bool_t xdr_Device_DocmdResp ();
+extern bool_t xdr_Device_SrqParms ();
 
 #endif /* K&R C */
 
@@ -157,6 +157,15 @@ destroy_intr_chan_1(void *argp, Device_Error *clnt_res, CLIENT *clnt)
 		TIMEOUT));
 }
 
+enum clnt_stat 
+device_intr_srq_1(Device_SrqParms *argp, void *clnt_res, CLIENT *clnt)
+{
+	return (clnt_call(clnt, device_intr_srq,
+		(xdrproc_t) xdr_Device_SrqParms, (caddr_t) argp,
+		(xdrproc_t) xdr_void, (caddr_t) clnt_res,
+		TIMEOUT));
+}
+
 #ifdef __GNUC__
 #pragma GCC diagnostic pop
 #endif
@@ -221,6 +221,52 @@ device_core_1(struct svc_req *rqstp, register SVCXPRT *transp)
 	return;
 }
 
+static void
+device_intr_1(struct svc_req *rqstp, register SVCXPRT *transp)
+{
+	union {
+		Device_SrqParms device_intr_srq_1_arg;
+	} argument;
+	union {
+	} result;
+	bool_t retval;
+	xdrproc_t _xdr_argument, _xdr_result;
+	bool_t (*local)(char *, void *, struct svc_req *);
+
+	switch (rqstp->rq_proc) {
+	case NULLPROC:
+		(void) svc_sendreply (transp, (xdrproc_t) xdr_void, (char *)NULL);
+		return;
+
+	case device_intr_srq:
+		_xdr_argument = (xdrproc_t) xdr_Device_SrqParms;
+		_xdr_result = (xdrproc_t) xdr_void;
+		local = (bool_t (*) (char *, void *,  struct svc_req *))device_intr_srq_1_svc;
+		break;
+
+	default:
+		svcerr_noproc (transp);
+		return;
+	}
+	memset ((char *)&argument, 0, sizeof (argument));
+	if (!svc_getargs (transp, (xdrproc_t) _xdr_argument, (caddr_t) &argument)) {
+		svcerr_decode (transp);
+		return;
+	}
+	retval = (bool_t) (*local)((char *)&argument, (void *)&result, rqstp);
+	if (retval > 0 && !svc_sendreply(transp, (xdrproc_t) _xdr_result, (char *)&result)) {
+		svcerr_systemerr (transp);
+	}
+	if (!svc_freeargs (transp, (xdrproc_t) _xdr_argument, (caddr_t) &argument)) {
+		fprintf (stderr, "%s", "unable to free arguments");
+		exit (1);
+	}
+	if (!device_intr_1_freeresult (transp, _xdr_result, (caddr_t) &result))
+		fprintf (stderr, "%s", "unable to free results");
+
+	return;
+}
+
 int
 main (int argc, char **argv)
 {
@@ -228,6 +274,7 @@ main (int argc, char **argv)
 
 	pmap_unset (DEVICE_ASYNC, DEVICE_ASYNC_VERSION);
 	pmap_unset (DEVICE_CORE, DEVICE_CORE_VERSION);
+	pmap_unset (DEVICE_INTR, DEVICE_INTR_VERSION);
 
 	transp = svcudp_create(RPC_ANYSOCK);
 	if (transp == NULL) {
@@ -242,6 +289,10 @@ main (int argc, char **argv)
 		fprintf (stderr, "%s", "unable to register (DEVICE_CORE, DEVICE_CORE_VERSION, udp).");
 		exit(1);
 	}
+	if (!svc_register(transp, DEVICE_INTR, DEVICE_INTR_VERSION, device_intr_1, IPPROTO_UDP)) {
+		fprintf (stderr, "%s", "unable to register (DEVICE_INTR, DEVICE_INTR_VERSION, udp).");
+		exit(1);
+	}
 
 	transp = svctcp_create(RPC_ANYSOCK, 0, 0);
 	if (transp == NULL) {
@@ -256,6 +307,10 @@ main (int argc, char **argv)
 		fprintf (stderr, "%s", "unable to register (DEVICE_CORE, DEVICE_CORE_VERSION, tcp).");
 		exit(1);
 	}
+	if (!svc_register(transp, DEVICE_INTR, DEVICE_INTR_VERSION, device_intr_1, IPPROTO_TCP)) {
+		fprintf (stderr, "%s", "unable to register (DEVICE_INTR, DEVICE_INTR_VERSION, tcp).");
+		exit(1);
+	}
 
 	svc_run ();
 	fprintf (stderr, "%s", "svc_run returned");
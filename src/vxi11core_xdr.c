@@ -450,3 +450,13 @@ xdr_Device_DocmdResp (XDR *xdrs, Device_DocmdResp *objp)
 		 return FALSE;
 	return TRUE;
 }
+
+bool_t
+xdr_Device_SrqParms (XDR *xdrs, Device_SrqParms *objp)
+{
+	register int32_t *buf;
+
+	 if (!xdr_bytes (xdrs, (char **)&objp->handle.handle_val, (u_int *) &objp->handle.handle_len, ~0))
+		 return FALSE;
+	return TRUE;
+}
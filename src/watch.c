@@ -0,0 +1,385 @@
+/*
+ * Copyright (c) 2017-2022  Martin Lund
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor contributors may be
+ *    used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <lxi.h>
+#include "watch.h"
+#include "vxi11.h"
+#include "mdns.h"
+#include "error.h"
+
+#define WATCHES_MAX              32
+#define WATCH_MISSED_MAX          2 // Search rounds a device may miss before it is removed
+
+typedef struct watch_entry
+{
+    char *address;
+    char *id;
+    char *service;  // NULL for devices found via VXI-11
+    int port;
+    int missed;
+    bool seen;
+    struct watch_entry *next;
+} watch_entry_t;
+
+typedef struct
+{
+    lxi_watch_info_t info;
+    lxi_discover_t type;
+    int timeout;
+    int interval;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool cancelled;
+    bool detached;
+    watch_entry_t *entries;
+} watch_t;
+
+static watch_t *watches[WATCHES_MAX] = {};
+static pthread_mutex_t watches_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Watch searching in this thread, discovery callbacks carry no context
+static __thread watch_t *watch_current = NULL;
+
+static void watch_notify(watch_t *watch, lxi_event_t event, watch_entry_t *entry)
+{
+    if (entry->service == NULL)
+    {
+        if (watch->info.device != NULL)
+            watch->info.device(event, entry->address, entry->id);
+    }
+    else
+    {
+        if (watch->info.service != NULL)
+            watch->info.service(event, entry->address, entry->id, entry->service, entry->port);
+    }
+}
+
+static void watch_entry_free(watch_entry_t *entry)
+{
+    free(entry->address);
+    free(entry->id);
+    free(entry->service);
+    free(entry);
+}
+
+static void watch_seen(watch_t *watch, const char *address, const char *id, const char *service, int port)
+{
+    watch_entry_t *entry;
+    char *id_new;
+
+    for (entry = watch->entries; entry != NULL; entry = entry->next)
+    {
+        if ((strcmp(entry->address, address) == 0) &&
+            (((service == NULL) && (entry->service == NULL)) ||
+             ((service != NULL) && (entry->service != NULL) && (strcmp(entry->service, service) == 0))))
+            break;
+    }
+
+    if (entry == NULL)
+    {
+        entry = calloc(1, sizeof(watch_entry_t));
+        if (entry == NULL)
+            return;
+
+        entry->address = strdup(address);
+        entry->id = strdup(id);
+        entry->service = (service != NULL) ? strdup(service) : NULL;
+        entry->port = port;
+        if ((entry->address == NULL) || (entry->id == NULL) || ((service != NULL) && (entry->service == NULL)))
+        {
+            watch_entry_free(entry);
+            return;
+        }
+
+        entry->seen = true;
+        entry->next = watch->entries;
+        watch->entries = entry;
+
+        watch_notify(watch, LXI_ADDED, entry);
+        return;
+    }
+
+    entry->seen = true;
+    entry->missed = 0;
+
+    if ((strcmp(entry->id, id) != 0) || (entry->port != port))
+    {
+        id_new = strdup(id);
+        if (id_new == NULL)
+            return;
+
+        free(entry->id);
+        entry->id = id_new;
+        entry->port = port;
+
+        watch_notify(watch, LXI_CHANGED, entry);
+    }
+}
+
+static void watch_device(const char *address, const char *id)
+{
+    if (watch_current != NULL)
+        watch_seen(watch_current, address, id, NULL, 0);
+}
+
+static void watch_service(const char *address, const char *id, const char *service, int port)
+{
+    if (watch_current != NULL)
+        watch_seen(watch_current, address, id, service, port);
+}
+
+static void watch_lost(watch_t *watch, const char *address, const char *service)
+{
+    watch_entry_t **link = &watch->entries;
+    watch_entry_t *entry;
+
+    while ((entry = *link) != NULL)
+    {
+        if ((strcmp(entry->address, address) == 0) && (entry->service != NULL) &&
+            (strcmp(entry->service, service) == 0))
+        {
+            *link = entry->next;
+            watch_notify(watch, LXI_REMOVED, entry);
+            watch_entry_free(entry);
+            return;
+        }
+
+        link = &entry->next;
+    }
+}
+
+static void watch_mdns_service(void *userdata, lxi_event_t event, const char *address, const char *id, const char *service, int port)
+{
+    watch_t *watch = (watch_t *) userdata;
+
+    if (event == LXI_REMOVED)
+        watch_lost(watch, address, service);
+    else
+        watch_seen(watch, address, id, service, port);
+}
+
+static bool watch_cancelled(void *userdata)
+{
+    watch_t *watch = (watch_t *) userdata;
+    bool cancelled;
+
+    pthread_mutex_lock(&watch->mutex);
+    cancelled = watch->cancelled;
+    pthread_mutex_unlock(&watch->mutex);
+
+    return cancelled;
+}
+
+// Remove devices which have not responded for a while
+static void watch_expire(watch_t *watch)
+{
+    watch_entry_t **link = &watch->entries;
+    watch_entry_t *entry;
+
+    while ((entry = *link) != NULL)
+    {
+        if (!entry->seen && (++entry->missed >= WATCH_MISSED_MAX))
+        {
+            *link = entry->next;
+            watch_notify(watch, LXI_REMOVED, entry);
+            watch_entry_free(entry);
+            continue;
+        }
+
+        entry->seen = false;
+        link = &entry->next;
+    }
+}
+
+static void watch_free(watch_t *watch)
+{
+    watch_entry_t *entry;
+
+    while ((entry = watch->entries) != NULL)
+    {
+        watch->entries = entry->next;
+        watch_entry_free(entry);
+    }
+
+    pthread_cond_destroy(&watch->cond);
+    pthread_mutex_destroy(&watch->mutex);
+    free(watch);
+}
+
+static void *thread_watch(void *ptr)
+{
+    watch_t *watch = (watch_t *) ptr;
+    lxi_info_t info = { .broadcast = NULL, .device = watch_device, .service = watch_service };
+    mdns_watch_t mdns = { .service = watch_mdns_service, .cancelled = watch_cancelled, .userdata = watch };
+    struct timespec ts;
+    bool cancelled = false;
+
+    watch_current = watch;
+
+    // Follow services as they come and go where mDNS browsers can be kept open
+    if ((watch->type == DISCOVER_MDNS) && (mdns_watch(&mdns, watch->interval) == 0))
+        cancelled = true;
+
+    while (!cancelled)
+    {
+        // Search and compare with what was found in previous rounds
+        if (watch->type == DISCOVER_VXI11)
+            vxi11_discover(&info, watch->timeout);
+        else
+            mdns_discover(&info, watch->timeout);
+
+        watch_expire(watch);
+
+        // Wait for next round
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        ts.tv_sec += watch->interval / 1000;
+        ts.tv_nsec += (watch->interval % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000)
+        {
+            ts.tv_sec += 1;
+            ts.tv_nsec -= 1000000000;
+        }
+
+        pthread_mutex_lock(&watch->mutex);
+        while (!watch->cancelled)
+        {
+            if (pthread_cond_timedwait(&watch->cond, &watch->mutex, &ts) == ETIMEDOUT)
+                break;
+        }
+        cancelled = watch->cancelled;
+        pthread_mutex_unlock(&watch->mutex);
+    }
+
+    watch_current = NULL;
+
+    // Nobody waits for a watch cancelled from its own callback
+    if (watch->detached)
+        watch_free(watch);
+
+    return NULL;
+}
+
+int watch_start(lxi_watch_info_t *info, int timeout, int interval, lxi_discover_t type)
+{
+    pthread_condattr_t attr;
+    watch_t *watch;
+    int i;
+
+    watch = calloc(1, sizeof(watch_t));
+    if (watch == NULL)
+        return -1;
+
+    watch->info = *info;
+    watch->type = type;
+    watch->timeout = timeout;
+    watch->interval = interval;
+
+    pthread_mutex_init(&watch->mutex, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&watch->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    // Find free watch handle
+    pthread_mutex_lock(&watches_mutex);
+    for (i = 0; i < WATCHES_MAX; i++)
+    {
+        if (watches[i] == NULL)
+            break;
+    }
+    if (i == WATCHES_MAX)
+    {
+        pthread_mutex_unlock(&watches_mutex);
+        error_printf("Too many discovery watches\n");
+        goto error_handle;
+    }
+    watches[i] = watch;
+    pthread_mutex_unlock(&watches_mutex);
+
+    if (pthread_create(&watch->thread, NULL, thread_watch, watch) != 0)
+    {
+        error_printf("Error pthread_create()\n");
+        pthread_mutex_lock(&watches_mutex);
+        watches[i] = NULL;
+        pthread_mutex_unlock(&watches_mutex);
+        goto error_handle;
+    }
+
+    return i;
+
+error_handle:
+    watch_free(watch);
+    return -1;
+}
+
+int watch_cancel(int watch_id)
+{
+    watch_t *watch;
+
+    if ((watch_id < 0) || (watch_id >= WATCHES_MAX))
+        return -1;
+
+    pthread_mutex_lock(&watches_mutex);
+    watch = watches[watch_id];
+    watches[watch_id] = NULL;
+    pthread_mutex_unlock(&watches_mutex);
+
+    if (watch == NULL)
+        return -1;
+
+    pthread_mutex_lock(&watch->mutex);
+    watch->cancelled = true;
+    pthread_cond_signal(&watch->cond);
+    pthread_mutex_unlock(&watch->mutex);
+
+    // Cancelled from own callback, clean up when round completes
+    if (pthread_equal(watch->thread, pthread_self()))
+    {
+        pthread_detach(watch->thread);
+        watch->detached = true;
+        watch->info.device = NULL;
+        watch->info.service = NULL;
+        return 0;
+    }
+
+    // Wait for ongoing search round to complete
+    pthread_join(watch->thread, NULL);
+    watch_free(watch);
+
+    return 0;
+}
@@ -0,0 +1,688 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#ifdef HAVE_OPENSSL
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#endif
+
+// Mock HiSLIP server for testing the HiSLIP client on localhost
+//
+// Serves one session at a time. Commands understood on the synchronous
+// channel, each answered with a single response:
+//
+//   *IDN?          Identification
+//   DATA? <n>      <n> bytes of counting pattern followed by newline
+//   LEN? <text>    Length of whole received command, for testing split sends
+//   ECHO <text>    <text>
+//   STB <n>        Set status byte reported by status query, no response
+//   SPLIT? <ms>    Response in two parts, DataEND following first Data after <ms>
+//   HUGE? <n>      <n> bytes in a single DataEND, ignoring negotiated message size
+//
+// Usage: hislip-mock [-p port] [-m max message size] [-d response delay ms] [-o]
+//                    [-c certificate -k key [-e]]
+//
+//   -o  Support overlapped mode, synchronized mode is used otherwise
+//   -c  Support encryption via HiSLIP 2.0 StartTLS with certificate and key
+//       in PEM format, needs building with -DHAVE_OPENSSL -lssl -lcrypto
+//   -e  Make encryption mandatory
+
+#define HEADER_SIZE                16
+#define PROTOCOL_VERSION           0x0100
+#define PROTOCOL_VERSION_TLS       0x0200
+#define SESSION_ID                 0x1234
+#define VENDOR_ID                  0x4c58
+
+#define INITIALIZE                 0
+#define INITIALIZE_RESPONSE        1
+#define ERROR                      3
+#define DATA                       6
+#define DATA_END                   7
+#define DEVICE_CLEAR_COMPLETE      8
+#define DEVICE_CLEAR_ACKNOWLEDGE   9
+#define TRIGGER                    12
+#define ASYNC_MAX_MESSAGE_SIZE     15
+#define ASYNC_MAX_MESSAGE_SIZE_RESP 16
+#define ASYNC_INITIALIZE           17
+#define ASYNC_INITIALIZE_RESPONSE  18
+#define ASYNC_DEVICE_CLEAR         19
+#define ASYNC_STATUS_QUERY         21
+#define ASYNC_STATUS_RESPONSE      22
+#define ASYNC_DEVICE_CLEAR_ACK     23
+#define START_TLS                  28
+#define ASYNC_START_TLS            29
+#define ASYNC_START_TLS_RESPONSE   30
+
+typedef struct
+{
+    uint8_t type;
+    uint8_t control;
+    uint32_t parameter;
+    uint64_t length;
+} header_t;
+
+typedef struct
+{
+    int socket;
+#ifdef HAVE_OPENSSL
+    SSL *ssl;
+    pthread_mutex_t ssl_mutex;
+#endif
+} channel_t;
+
+typedef struct response
+{
+    long long due;
+    uint32_t message_id;
+    char *data;
+    size_t length;
+    bool more;
+    struct response *next;
+} response_t;
+
+static int port = 4880;
+static uint64_t max_message_size = 4096;
+static int delay;
+static bool overlap;
+static bool mandatory;
+#ifdef HAVE_OPENSSL
+static SSL_CTX *tls_context;
+#endif
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static response_t *queue;
+static channel_t *sync_channel;
+static uint64_t send_size;
+static uint8_t status_byte;
+
+static long long time_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+#ifdef HAVE_OPENSSL
+// Sender thread writes while connection thread reads, an SSL object allows
+// one call at a time so wait for data before taking the lock
+static int tls_read(channel_t *channel, void *buffer, size_t length)
+{
+    struct pollfd pfd = { .fd = channel->socket, .events = POLLIN };
+    int n;
+
+    pthread_mutex_lock(&channel->ssl_mutex);
+    while (SSL_pending(channel->ssl) == 0)
+    {
+        pthread_mutex_unlock(&channel->ssl_mutex);
+        if (poll(&pfd, 1, -1) < 0)
+            return -1;
+        pthread_mutex_lock(&channel->ssl_mutex);
+        if (pfd.revents)
+            break;
+    }
+    n = SSL_read(channel->ssl, buffer, length);
+    pthread_mutex_unlock(&channel->ssl_mutex);
+
+    return n;
+}
+
+static int tls_write(channel_t *channel, const void *buffer, size_t length)
+{
+    int n;
+
+    pthread_mutex_lock(&channel->ssl_mutex);
+    n = SSL_write(channel->ssl, buffer, length);
+    pthread_mutex_unlock(&channel->ssl_mutex);
+
+    return n;
+}
+
+static int start_tls(channel_t *channel)
+{
+    SSL *ssl = SSL_new(tls_context);
+
+    if ((ssl == NULL) || (SSL_set_fd(ssl, channel->socket) != 1) || (SSL_accept(ssl) != 1))
+    {
+        fprintf(stderr, "TLS handshake failed\n");
+        ERR_print_errors_fp(stderr);
+        SSL_free(ssl);
+        return -1;
+    }
+
+    pthread_mutex_lock(&channel->ssl_mutex);
+    channel->ssl = ssl;
+    pthread_mutex_unlock(&channel->ssl_mutex);
+
+    return 0;
+}
+#endif
+
+static int read_all(channel_t *channel, void *buffer, size_t length)
+{
+    ssize_t n;
+
+    while (length > 0)
+    {
+#ifdef HAVE_OPENSSL
+        if (channel->ssl != NULL)
+            n = tls_read(channel, buffer, length);
+        else
+#endif
+            n = recv(channel->socket, buffer, length, 0);
+        if (n <= 0)
+            return -1;
+        buffer = (char *) buffer + n;
+        length -= n;
+    }
+
+    return 0;
+}
+
+static int write_all(channel_t *channel, const void *buffer, size_t length, int flags)
+{
+#ifdef HAVE_OPENSSL
+    if (channel->ssl != NULL)
+        return (tls_write(channel, buffer, length) == (int) length) ? 0 : -1;
+#endif
+    return (send(channel->socket, buffer, length, MSG_NOSIGNAL | flags) == (ssize_t) length) ? 0 : -1;
+}
+
+static int write_message(channel_t *channel, uint8_t type, uint8_t control, uint32_t parameter,
+                         const void *payload, uint64_t length)
+{
+    uint8_t header[HEADER_SIZE] = { 'H', 'S', type, control };
+    int i;
+
+    for (i = 0; i < 4; i++)
+        header[4 + i] = parameter >> (24 - 8 * i);
+    for (i = 0; i < 8; i++)
+        header[8 + i] = length >> (56 - 8 * i);
+
+    if (write_all(channel, header, sizeof(header), (length > 0) ? MSG_MORE : 0) != 0)
+        return -1;
+    if ((length > 0) && (write_all(channel, payload, length, 0) != 0))
+        return -1;
+
+    return 0;
+}
+
+static int read_header(channel_t *channel, header_t *header)
+{
+    uint8_t buffer[HEADER_SIZE];
+    int i;
+
+    if (read_all(channel, buffer, sizeof(buffer)) != 0)
+        return -1;
+    if ((buffer[0] != 'H') || (buffer[1] != 'S'))
+    {
+        fprintf(stderr, "Bad message prologue\n");
+        return -1;
+    }
+
+    header->type = buffer[2];
+    header->control = buffer[3];
+    header->parameter = 0;
+    for (i = 0; i < 4; i++)
+        header->parameter = (header->parameter << 8) | buffer[4 + i];
+    header->length = 0;
+    for (i = 0; i < 8; i++)
+        header->length = (header->length << 8) | buffer[8 + i];
+
+    return 0;
+}
+
+static void *read_payload(channel_t *channel, header_t *header)
+{
+    char *payload = malloc(header->length + 1);
+
+    if ((payload == NULL) || (read_all(channel, payload, header->length) != 0))
+    {
+        free(payload);
+        return NULL;
+    }
+    payload[header->length] = 0;
+
+    return payload;
+}
+
+// Split response into Data messages of negotiated size terminated by DataEND
+// unless more of it follows
+static int write_response(uint32_t message_id, const char *data, size_t length, bool more)
+{
+    size_t chunk = send_size - HEADER_SIZE;
+    size_t offset = 0, size;
+    uint8_t type;
+
+    do
+    {
+        size = length - offset;
+        if (size > chunk)
+            size = chunk;
+        type = (((offset + size) == length) && !more) ? DATA_END : DATA;
+        if (write_message(sync_channel, type, 0, message_id, data + offset, size) != 0)
+            return -1;
+        offset += size;
+    } while (offset < length);
+
+    return 0;
+}
+
+// Responses are sent in order by sender thread, after delay if configured
+static void queue_response(uint32_t message_id, char *data, size_t length, int later, bool more)
+{
+    response_t *response = calloc(1, sizeof(response_t));
+    response_t **tail;
+
+    if (response == NULL)
+    {
+        free(data);
+        return;
+    }
+    response->due = time_ms() + delay + later;
+    response->message_id = message_id;
+    response->data = data;
+    response->length = length;
+    response->more = more;
+
+    pthread_mutex_lock(&mutex);
+    for (tail = &queue; *tail != NULL; tail = &(*tail)->next)
+        ;
+    *tail = response;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&mutex);
+}
+
+static void queue_flush(void)
+{
+    response_t *response;
+
+    while (queue != NULL)
+    {
+        response = queue;
+        queue = response->next;
+        free(response->data);
+        free(response);
+    }
+}
+
+static void *thread_sender(void *arg)
+{
+    response_t *response;
+    long long wait;
+
+    pthread_mutex_lock(&mutex);
+    for (;;)
+    {
+        while (queue == NULL)
+            pthread_cond_wait(&cond, &mutex);
+
+        wait = queue->due - time_ms();
+        if (wait > 0)
+        {
+            pthread_mutex_unlock(&mutex);
+            usleep(wait * 1000);
+            pthread_mutex_lock(&mutex);
+            continue;
+        }
+
+        // Sent under lock so device clear can't interleave with a response
+        response = queue;
+        queue = response->next;
+        write_response(response->message_id, response->data, response->length, response->more);
+        free(response->data);
+        free(response);
+    }
+
+    return NULL;
+}
+
+static void execute(uint32_t message_id, const char *command, size_t length)
+{
+    char *response = NULL;
+    size_t size = 0;
+    long n, i;
+
+    if (strncmp(command, "*IDN?", 5) == 0)
+        size = asprintf(&response, "LXI,HISLIP-MOCK,0,1.0\n");
+    else if (strncmp(command, "DATA? ", 6) == 0)
+    {
+        n = strtol(command + 6, NULL, 10);
+        response = malloc(n + 1);
+        if (response == NULL)
+            return;
+        for (i = 0; i < n; i++)
+            response[i] = '0' + (i % 10);
+        response[n] = '\n';
+        size = n + 1;
+    }
+    else if (strncmp(command, "LEN? ", 5) == 0)
+        size = asprintf(&response, "%zu\n", length);
+    else if (strncmp(command, "ECHO ", 5) == 0)
+        size = asprintf(&response, "%.*s", (int) (length - 5), command + 5);
+    else if (strncmp(command, "STB ", 4) == 0)
+    {
+        pthread_mutex_lock(&mutex);
+        status_byte = strtol(command + 4, NULL, 0);
+        pthread_mutex_unlock(&mutex);
+    }
+    else if (strncmp(command, "SPLIT? ", 7) == 0)
+    {
+        n = strtol(command + 7, NULL, 10);
+        queue_response(message_id, strdup("first "), 6, 0, true);
+        size = asprintf(&response, "second\n");
+        queue_response(message_id, response, size, n, false);
+        return;
+    }
+    else if (strncmp(command, "HUGE? ", 6) == 0)
+    {
+        // Misbehaving device, sent right away so it arrives before responses queued later
+        n = strtol(command + 6, NULL, 10);
+        response = calloc(1, n);
+        if (response == NULL)
+            return;
+        pthread_mutex_lock(&mutex);
+        write_message(sync_channel, DATA_END, 0, message_id, response, n);
+        pthread_mutex_unlock(&mutex);
+        free(response);
+        return;
+    }
+
+    if (response != NULL)
+        queue_response(message_id, response, size, 0, false);
+}
+
+static void sync_loop(channel_t *channel)
+{
+    header_t header;
+    char *payload, *command = NULL, *grown;
+    size_t length = 0;
+
+    for (;;)
+    {
+        if (read_header(channel, &header) != 0)
+            break;
+        payload = read_payload(channel, &header);
+        if (payload == NULL)
+            break;
+
+        switch (header.type)
+        {
+            case DATA:
+            case DATA_END:
+                // Command may span several Data messages
+                grown = realloc(command, length + header.length + 1);
+                if (grown == NULL)
+                    break;
+                command = grown;
+                memcpy(command + length, payload, header.length);
+                length += header.length;
+                command[length] = 0;
+                if (header.type == DATA_END)
+                {
+                    execute(header.parameter, command, length);
+                    length = 0;
+                }
+                break;
+
+            case TRIGGER:
+                break;
+
+#ifdef HAVE_OPENSSL
+            case START_TLS:
+                if ((tls_context == NULL) || (start_tls(channel) != 0))
+                {
+                    free(payload);
+                    free(command);
+                    return;
+                }
+                break;
+#endif
+
+            case DEVICE_CLEAR_COMPLETE:
+                // Client asks for mode, overlapped only if supported
+                pthread_mutex_lock(&mutex);
+                length = 0;
+                write_message(channel, DEVICE_CLEAR_ACKNOWLEDGE, overlap && (header.control & 1), 0, NULL, 0);
+                pthread_mutex_unlock(&mutex);
+                break;
+
+            default:
+                fprintf(stderr, "Unexpected message type %d on synchronous channel\n", header.type);
+                break;
+        }
+        free(payload);
+    }
+
+    free(command);
+}
+
+static void async_loop(channel_t *channel)
+{
+    header_t header;
+    uint8_t *payload, size[8];
+    uint64_t requested;
+    int i;
+
+    for (;;)
+    {
+        if (read_header(channel, &header) != 0)
+            break;
+        payload = read_payload(channel, &header);
+        if (payload == NULL)
+            break;
+
+        switch (header.type)
+        {
+            case ASYNC_MAX_MESSAGE_SIZE:
+                requested = 0;
+                for (i = 0; (i < 8) && (i < (int) header.length); i++)
+                    requested = (requested << 8) | payload[i];
+
+                // Responses are limited by what both sides accept
+                pthread_mutex_lock(&mutex);
+                send_size = (requested < max_message_size) ? requested : max_message_size;
+                pthread_mutex_unlock(&mutex);
+
+                for (i = 0; i < 8; i++)
+                    size[i] = max_message_size >> (56 - 8 * i);
+                write_message(channel, ASYNC_MAX_MESSAGE_SIZE_RESP, 0, 0, size, sizeof(size));
+                break;
+
+            case ASYNC_DEVICE_CLEAR:
+                pthread_mutex_lock(&mutex);
+                queue_flush();
+                pthread_mutex_unlock(&mutex);
+                write_message(channel, ASYNC_DEVICE_CLEAR_ACK, overlap, 0, NULL, 0);
+                break;
+
+            case ASYNC_STATUS_QUERY:
+                pthread_mutex_lock(&mutex);
+                i = status_byte;
+                pthread_mutex_unlock(&mutex);
+                write_message(channel, ASYNC_STATUS_RESPONSE, i, 0, NULL, 0);
+                break;
+
+#ifdef HAVE_OPENSSL
+            case ASYNC_START_TLS:
+                // Client starts handshake on receiving success
+                if (tls_context == NULL)
+                    write_message(channel, ASYNC_START_TLS_RESPONSE, 0, 0, NULL, 0);
+                else if ((write_message(channel, ASYNC_START_TLS_RESPONSE, 1, 0, NULL, 0) != 0) ||
+                         (start_tls(channel) != 0))
+                {
+                    free(payload);
+                    return;
+                }
+                break;
+#endif
+
+            default:
+                write_message(channel, ERROR, 0, 0, "Unsupported", 11);
+                break;
+        }
+        free(payload);
+    }
+}
+
+static void *thread_connection(void *arg)
+{
+    channel_t channel = { .socket = (int) (intptr_t) arg };
+    header_t header;
+    uint8_t control;
+    uint16_t version = PROTOCOL_VERSION;
+    char *payload;
+    int one = 1;
+
+    setsockopt(channel.socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#ifdef HAVE_OPENSSL
+    pthread_mutex_init(&channel.ssl_mutex, NULL);
+    if (tls_context != NULL)
+        version = PROTOCOL_VERSION_TLS;
+#endif
+
+    if ((read_header(&channel, &header) != 0) || ((payload = read_payload(&channel, &header)) == NULL))
+        goto out;
+
+    if (header.type == INITIALIZE)
+    {
+        control = (overlap ? 1 : 0) | (mandatory ? 2 : 0);
+
+        // New session starts in synchronized mode with default message size
+        pthread_mutex_lock(&mutex);
+        queue_flush();
+        sync_channel = &channel;
+        send_size = max_message_size;
+        status_byte = 0;
+        write_message(&channel, INITIALIZE_RESPONSE, control,
+                      ((uint32_t) version << 16) | SESSION_ID, NULL, 0);
+        pthread_mutex_unlock(&mutex);
+
+        printf("Session opened for %s\n", payload);
+        sync_loop(&channel);
+
+        pthread_mutex_lock(&mutex);
+        queue_flush();
+        sync_channel = NULL;
+        pthread_mutex_unlock(&mutex);
+        printf("Session closed\n");
+    }
+    else if (header.type == ASYNC_INITIALIZE)
+    {
+        write_message(&channel, ASYNC_INITIALIZE_RESPONSE, 0, VENDOR_ID, NULL, 0);
+        async_loop(&channel);
+    }
+    else
+        fprintf(stderr, "Unexpected message type %d on new connection\n", header.type);
+
+    free(payload);
+
+out:
+#ifdef HAVE_OPENSSL
+    SSL_free(channel.ssl);
+    pthread_mutex_destroy(&channel.ssl_mutex);
+#endif
+    close(channel.socket);
+
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    struct sockaddr_in address;
+    pthread_t thread;
+    const char *certificate = NULL, *key = NULL;
+    int server, client, option, one = 1;
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    while ((option = getopt(argc, argv, "p:m:d:oc:k:e")) != -1)
+    {
+        switch (option)
+        {
+            case 'p': port = atoi(optarg); break;
+            case 'm': max_message_size = strtoull(optarg, NULL, 0); break;
+            case 'd': delay = atoi(optarg); break;
+            case 'o': overlap = true; break;
+            case 'c': certificate = optarg; break;
+            case 'k': key = optarg; break;
+            case 'e': mandatory = true; break;
+            default:
+                fprintf(stderr, "Usage: %s [-p port] [-m max message size] [-d response delay ms] [-o] "
+                        "[-c certificate -k key [-e]]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if ((certificate != NULL) || (key != NULL) || mandatory)
+    {
+#ifdef HAVE_OPENSSL
+        tls_context = SSL_CTX_new(TLS_server_method());
+        if ((tls_context == NULL) ||
+            (SSL_CTX_use_certificate_chain_file(tls_context, certificate ? certificate : "") != 1) ||
+            (SSL_CTX_use_PrivateKey_file(tls_context, key ? key : "", SSL_FILETYPE_PEM) != 1))
+        {
+            fprintf(stderr, "Failed to load certificate and key\n");
+            ERR_print_errors_fp(stderr);
+            return 1;
+        }
+#else
+        fprintf(stderr, "Encryption needs building with -DHAVE_OPENSSL\n");
+        return 1;
+#endif
+    }
+
+    if (max_message_size <= HEADER_SIZE)
+    {
+        fprintf(stderr, "Maximum message size must exceed header size\n");
+        return 1;
+    }
+
+    server = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if ((bind(server, (struct sockaddr *) &address, sizeof(address)) != 0) || (listen(server, 4) != 0))
+    {
+        perror("Listen failed");
+        return 1;
+    }
+
+    pthread_create(&thread, NULL, thread_sender, NULL);
+
+    printf("Serving HiSLIP on 127.0.0.1:%d\n", port);
+
+    for (;;)
+    {
+        client = accept(server, NULL, NULL);
+        if (client < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("Accept failed");
+            return 1;
+        }
+        if (pthread_create(&thread, NULL, thread_connection, (void *) (intptr_t) client) != 0)
+            close(client);
+        else
+            pthread_detach(thread);
+    }
+}
@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <lxi.h>
+
+// Benchmark - queries in synchronized versus overlapped HiSLIP mode
+//
+// Run against hislip-mock injecting response latency, e.g. 50 ms:
+//
+//   hislip-mock -o -d 50 &
+//   hislip-overlap-bench
+//
+// Synchronized mode pays the latency once per query, overlapped mode once
+// for all queries in flight.
+
+#define QUERIES 30
+#define TIMEOUT 5000
+
+static long long time_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int main()
+{
+    char command[64], response[64];
+    unsigned int id[QUERIES];
+    long long start;
+    int device, i, n, errors = 0;
+
+    lxi_init();
+
+    device = lxi_connect("127.0.0.1", 0, NULL, TIMEOUT, HISLIP);
+    if (device < 0)
+    {
+        printf("Failed to connect\n");
+        return 1;
+    }
+
+    // One query at a time
+    start = time_ms();
+    for (i = 0; i < QUERIES; i++)
+    {
+        n = sprintf(command, "ECHO %d\n", i);
+        lxi_send(device, command, n, TIMEOUT);
+        n = lxi_receive(device, response, sizeof(response) - 1, TIMEOUT);
+        if (n >= 0)
+            response[n] = 0;
+        if ((n < 0) || (atoi(response) != i))
+            errors++;
+    }
+    printf("Synchronized: %d queries in %lld ms\n", QUERIES, time_ms() - start);
+
+    if (lxi_set_overlapped(device, 1, TIMEOUT) != LXI_OK)
+    {
+        printf("Failed to enter overlapped mode\n");
+        return 1;
+    }
+
+    // All queries in flight, responses collected in reverse order
+    start = time_ms();
+    for (i = 0; i < QUERIES; i++)
+    {
+        n = sprintf(command, "ECHO %d\n", i);
+        lxi_send_query(device, command, n, &id[i], TIMEOUT);
+    }
+    for (i = QUERIES - 1; i >= 0; i--)
+    {
+        n = lxi_receive_response(device, id[i], response, sizeof(response) - 1, TIMEOUT);
+        if (n >= 0)
+            response[n] = 0;
+        if ((n < 0) || (atoi(response) != i))
+            errors++;
+    }
+    printf("Overlapped:   %d queries in %lld ms\n", QUERIES, time_ms() - start);
+
+    lxi_disconnect(device);
+
+    printf("%d error(s)\n", errors);
+
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <lxi.h>
+
+// Benchmark - encrypted versus plaintext HiSLIP throughput on loopback
+//
+// Run against hislip-mock built with -DHAVE_OPENSSL, passing the
+// certificate to trust:
+//
+//   openssl req -x509 -newkey rsa:2048 -nodes -subj /CN=127.0.0.1
+//           -addext subjectAltName=IP:127.0.0.1 -keyout key.pem -out cert.pem
+//   hislip-mock -m 1048576 -c cert.pem -k key.pem &
+//   hislip-tls-bench cert.pem
+//
+// Sending is offloaded to kernel TLS when the tls module is available
+// (listed in /proc/sys/net/ipv4/tcp_available_ulp), otherwise OpenSSL
+// encrypts in user space.
+
+#define RESPONSE_SIZE 10000000
+#define TRANSFERS     10
+#define TIMEOUT       10000
+
+static long long time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int ktls_available(void)
+{
+    char ulp[256] = "";
+    FILE *file = fopen("/proc/sys/net/ipv4/tcp_available_ulp", "r");
+
+    if (file == NULL)
+        return 0;
+    if (fgets(ulp, sizeof(ulp), file) == NULL)
+        ulp[0] = 0;
+    fclose(file);
+
+    return strstr(ulp, "tls") != NULL;
+}
+
+// Returns throughput in MB/s, negative on error
+static double throughput(lxi_protocol_t protocol, char *response)
+{
+    char command[32];
+    long long start, elapsed;
+    int device, i, n, length;
+
+    device = lxi_connect("127.0.0.1", 0, NULL, TIMEOUT, protocol);
+    if (device < 0)
+        return -1;
+
+    length = sprintf(command, "DATA? %d\n", RESPONSE_SIZE);
+
+    start = time_us();
+    for (i = 0; i < TRANSFERS; i++)
+    {
+        lxi_send(device, command, length, TIMEOUT);
+        n = lxi_receive(device, response, RESPONSE_SIZE + 1, TIMEOUT);
+        if (n != RESPONSE_SIZE + 1)
+        {
+            lxi_disconnect(device);
+            return -1;
+        }
+    }
+    elapsed = time_us() - start;
+
+    lxi_disconnect(device);
+
+    return (double) RESPONSE_SIZE * TRANSFERS / elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+    char *response;
+    double plain, encrypted;
+
+    if (argc != 2)
+    {
+        printf("Usage: %s <CA certificate file>\n", argv[0]);
+        return 1;
+    }
+
+    response = malloc(RESPONSE_SIZE + 1);
+    if (response == NULL)
+        return 1;
+
+    lxi_init();
+    lxi_set_tls_ca(argv[1]);
+
+    plain = throughput(HISLIP, response);
+    encrypted = throughput(HISLIP_TLS, response);
+
+    printf("Plaintext: %.0f MB/s\n", plain);
+    printf("TLS (%s): %.0f MB/s\n", ktls_available() ? "kernel TLS available" : "OpenSSL fallback", encrypted);
+
+    free(response);
+
+    return ((plain < 0) || (encrypted < 0)) ? 1 : 0;
+}
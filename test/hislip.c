@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <lxi.h>
+
+// Test - exercise HiSLIP client against hislip-mock on localhost
+//
+// Start mock with a small maximum message size so messages get split:
+//
+//   hislip-mock -m 256 -o &
+//   hislip
+//
+// Build with -lpthread as status queries are also run from a second thread.
+
+#define TIMEOUT 1000
+
+static int failures = 0;
+
+static void check(int condition, const char *description)
+{
+    printf("%s: %s\n", condition ? "PASS" : "FAIL", description);
+    if (!condition)
+        failures++;
+}
+
+static int status_errors;
+
+static void *thread_status(void *arg)
+{
+    int device = *(int *) arg;
+    int i;
+
+    for (i = 0; i < 200; i++)
+    {
+        if (lxi_read_stb(device, TIMEOUT) != 0x42)
+            status_errors++;
+    }
+
+    return NULL;
+}
+
+static int query(int device, const char *command, char *response, int length)
+{
+    int n;
+
+    if (lxi_send(device, command, strlen(command), TIMEOUT) < 0)
+        return -1;
+
+    n = lxi_receive(device, response, length - 1, TIMEOUT);
+    if (n >= 0)
+        response[n] = 0;
+
+    return n;
+}
+
+int main()
+{
+    static char response[100000], command[2000];
+    unsigned int split, unanswered;
+    pthread_t thread;
+    int device, n, i, ok;
+
+    // Initialize LXI library
+    lxi_init();
+
+    // Initialize, async initialize and maximum message size exchange
+    device = lxi_connect("127.0.0.1", 0, NULL, TIMEOUT, HISLIP);
+    check(device >= 0, "connect");
+    if (device < 0)
+        return 1;
+
+    n = query(device, "*IDN?\n", response, sizeof(response));
+    check((n > 0) && (strcmp(response, "LXI,HISLIP-MOCK,0,1.0\n") == 0), "identification");
+
+    // Response split by mock into Data messages terminated by DataEND
+    n = query(device, "DATA? 50000\n", response, sizeof(response));
+    ok = (n == 50001) && (response[50000] == '\n');
+    for (i = 0; ok && (i < 50000); i++)
+        ok = (response[i] == '0' + (i % 10));
+    check(ok, "response spanning many messages");
+
+    // Command split by client according to negotiated maximum message size
+    memset(command, 'x', sizeof(command));
+    memcpy(command, "LEN? ", 5);
+    command[sizeof(command) - 1] = '\n';
+    if (lxi_send(device, command, sizeof(command), TIMEOUT) == sizeof(command))
+        n = lxi_receive(device, response, sizeof(response) - 1, TIMEOUT);
+    else
+        n = -1;
+    check((n > 0) && (atoi(response) == (int) sizeof(command)), "command spanning many messages");
+
+    // Buffer too small for response
+    lxi_send(device, "DATA? 1000\n", 11, TIMEOUT);
+    check(lxi_receive(device, response, 100, TIMEOUT) < 0, "response overflow reported");
+
+    // Status query on asynchronous channel
+    lxi_send(device, "STB 0x42\n", 9, TIMEOUT);
+    check(lxi_read_stb(device, TIMEOUT) == 0x42, "status query");
+
+    // Status queries from another thread while transfers are in progress
+    pthread_create(&thread, NULL, thread_status, &device);
+    for (i = 0, ok = 1; i < 20; i++)
+        ok &= (query(device, "DATA? 50000\n", response, sizeof(response)) == 50001);
+    pthread_join(thread, NULL);
+    check(ok && (status_errors == 0), "status query during transfers");
+
+    // Device clear discards queued response
+    lxi_send(device, "*IDN?\n", 6, TIMEOUT);
+    check(lxi_clear(device, TIMEOUT) == LXI_OK, "device clear");
+    n = query(device, "ECHO after clear\n", response, sizeof(response));
+    check((n > 0) && (strcmp(response, "after clear\n") == 0), "response after device clear");
+
+    // Device clear also switches between synchronized and overlapped mode
+    check(lxi_set_overlapped(device, 1, TIMEOUT) == LXI_OK, "overlapped mode");
+    n = query(device, "*IDN?\n", response, sizeof(response));
+    check(n > 0, "query in overlapped mode");
+
+    // Response started while waiting for another one is completed by any receive
+    lxi_send_query(device, "SPLIT? 200\n", 11, &split, TIMEOUT);
+    lxi_send_query(device, "STB 0\n", 6, &unanswered, TIMEOUT);
+    lxi_receive_response(device, unanswered, response, sizeof(response), 100);
+    n = lxi_receive(device, response, sizeof(response) - 1, TIMEOUT);
+    if (n >= 0)
+        response[n] = 0;
+    check((n > 0) && (strcmp(response, "first second\n") == 0), "partly received response completed");
+
+    check(lxi_set_overlapped(device, 0, TIMEOUT) == LXI_OK, "synchronized mode");
+
+    check(lxi_disconnect(device) == LXI_OK, "disconnect");
+
+    // Response kept for later exceeding message size advertised by client
+    device = lxi_connect("127.0.0.1", 0, NULL, TIMEOUT, HISLIP);
+    lxi_set_overlapped(device, 1, TIMEOUT);
+    lxi_send_query(device, "HUGE? 2000000\n", 14, &split, TIMEOUT);
+    lxi_send_query(device, "*IDN?\n", 6, &unanswered, TIMEOUT);
+    n = lxi_receive_response(device, unanswered, response, sizeof(response), TIMEOUT);
+    check(n < 0, "oversized response rejected");
+    lxi_disconnect(device);
+
+    printf("%d failure(s)\n", failures);
+
+    return failures ? 1 : 0;
+}
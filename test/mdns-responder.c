@@ -0,0 +1,485 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// Mock mDNS responder for testing mDNS discovery without real instruments
+//
+// Announces a few LXI services on IPv4. Each PTR answer comes in a single
+// packet together with the SRV, TXT, A and AAAA records of the instance in
+// the additional section, the way most instruments respond. Services listed
+// as known answers in a query are left out (RFC 6762, 7.1), so repeat
+// queries carrying all services are not answered at all. Each query
+// received is logged with its counts of known and suppressed answers.
+//
+// Queries sent from a port other than 5353 are answered by unicast to the
+// sender (RFC 6762, 6.7), other queries by multicast.
+//
+// Usage: mdns-responder [-a interface address] [-s]
+//
+//   -a  Receive queries on the interface with this IPv4 address, any by default
+//   -s  Split mode, answer only what is asked so the querier has to resolve
+//       instances and host names by further questions
+//
+// Run with search-mdns or any other mDNS discovery on the same network:
+//
+//   mdns-responder -a 192.0.2.2 &
+//   search-mdns
+
+#define MDNS_PORT          5353
+#define MDNS_GROUP         "224.0.0.251"
+#define PACKET_SIZE        9000
+#define NAME_LENGTH_MAX    256
+
+#define FLAG_RESPONSE      0x8000
+#define FLAG_AUTHORITATIVE 0x0400
+#define CLASS_IN           1
+#define CLASS_FLUSH        0x8000
+#define TYPE_A             1
+#define TYPE_PTR           12
+#define TYPE_TXT           16
+#define TYPE_AAAA          28
+#define TYPE_SRV           33
+
+#define TTL                120
+#define TTL_LEGACY_UNICAST 10
+
+typedef struct
+{
+    const char *instance;
+    const char *type;
+    const char *host;
+    uint16_t port;
+    const char *ipv4;
+    const char *ipv6;
+    const char *txt[4];
+} service_t;
+
+static const service_t services[] =
+{
+    { "Scope A", "_lxi._tcp.local", "scope-a.local", 80, "192.0.2.2", "fd00::2",
+      { "Manufacturer=Acme", "Model=Scope A1", "SerialNumber=SN42", "FirmwareVersion=2.0" } },
+    { "Scope A", "_scpi-raw._tcp.local", "scope-a.local", 5025, "192.0.2.2", "fd00::2",
+      { "txtvers=1" } },
+    { "DMM B", "_vxi-11._tcp.local", "dmm-b.local", 111, "192.0.2.77", "fe80::1",
+      { "txtvers=1" } },
+};
+
+#define SERVICE_COUNT (sizeof(services) / sizeof(services[0]))
+
+typedef struct
+{
+    uint8_t data[PACKET_SIZE];
+    size_t length;
+    bool full;
+} packet_t;
+
+static bool split = false;
+
+static void put(packet_t *packet, const void *data, size_t length)
+{
+    if (packet->length + length > sizeof(packet->data))
+    {
+        packet->full = true;
+        return;
+    }
+
+    memcpy(packet->data + packet->length, data, length);
+    packet->length += length;
+}
+
+static void put_u16(packet_t *packet, uint16_t value)
+{
+    uint8_t data[2] = { value >> 8, value & 0xff };
+
+    put(packet, data, sizeof(data));
+}
+
+static void put_u32(packet_t *packet, uint32_t value)
+{
+    put_u16(packet, value >> 16);
+    put_u16(packet, value & 0xffff);
+}
+
+// Dotted name in wire format, uncompressed
+static void put_name(packet_t *packet, const char *name)
+{
+    const char *dot;
+    uint8_t length;
+
+    while (*name)
+    {
+        dot = strchr(name, '.');
+        length = dot ? (size_t) (dot - name) : strlen(name);
+        put(packet, &length, 1);
+        put(packet, name, length);
+        name += length + (dot ? 1 : 0);
+    }
+    put(packet, "", 1);
+}
+
+static void put_instance(packet_t *packet, const service_t *service)
+{
+    char name[NAME_LENGTH_MAX];
+
+    snprintf(name, sizeof(name), "%s.%s", service->instance, service->type);
+    put_name(packet, name);
+}
+
+// Record header followed by room for data length, returns offset of length
+static size_t put_record(packet_t *packet, uint16_t type, bool flush, uint32_t ttl)
+{
+    size_t offset;
+
+    put_u16(packet, type);
+    put_u16(packet, CLASS_IN | (flush ? CLASS_FLUSH : 0));
+    put_u32(packet, ttl);
+    offset = packet->length;
+    put_u16(packet, 0);
+
+    return offset;
+}
+
+static void end_record(packet_t *packet, size_t offset)
+{
+    uint16_t length = packet->length - offset - 2;
+
+    if (packet->full)
+        return;
+
+    packet->data[offset] = length >> 8;
+    packet->data[offset + 1] = length & 0xff;
+}
+
+static void put_ptr(packet_t *packet, const service_t *service, uint32_t ttl)
+{
+    size_t offset;
+
+    put_name(packet, service->type);
+    offset = put_record(packet, TYPE_PTR, false, ttl);
+    put_instance(packet, service);
+    end_record(packet, offset);
+}
+
+static void put_srv(packet_t *packet, const service_t *service, uint32_t ttl)
+{
+    size_t offset;
+
+    put_instance(packet, service);
+    offset = put_record(packet, TYPE_SRV, true, ttl);
+    put_u16(packet, 0); // Priority
+    put_u16(packet, 0); // Weight
+    put_u16(packet, service->port);
+    put_name(packet, service->host);
+    end_record(packet, offset);
+}
+
+static void put_txt(packet_t *packet, const service_t *service, uint32_t ttl)
+{
+    size_t offset;
+    uint8_t length;
+    int i;
+
+    put_instance(packet, service);
+    offset = put_record(packet, TYPE_TXT, true, ttl);
+    for (i = 0; (i < 4) && (service->txt[i] != NULL); i++)
+    {
+        length = strlen(service->txt[i]);
+        put(packet, &length, 1);
+        put(packet, service->txt[i], length);
+    }
+    end_record(packet, offset);
+}
+
+static void put_address(packet_t *packet, const service_t *service, int family, uint32_t ttl)
+{
+    uint8_t address[16];
+    size_t offset;
+
+    put_name(packet, service->host);
+    offset = put_record(packet, (family == AF_INET) ? TYPE_A : TYPE_AAAA, true, ttl);
+    inet_pton(family, (family == AF_INET) ? service->ipv4 : service->ipv6, address);
+    put(packet, address, (family == AF_INET) ? 4 : 16);
+    end_record(packet, offset);
+}
+
+// Dotted name at offset following compression pointers, returns offset past it or 0 if malformed
+static size_t read_name(const uint8_t *data, size_t length, size_t offset, char *name)
+{
+    size_t end = 0, used = 0;
+    int jumps = 0;
+    uint8_t label;
+
+    while (offset < length)
+    {
+        label = data[offset];
+
+        if ((label & 0xc0) == 0xc0)
+        {
+            if ((offset + 1 >= length) || (++jumps > 16))
+                return 0;
+            if (end == 0)
+                end = offset + 2;
+            offset = ((label & 0x3f) << 8) | data[offset + 1];
+            continue;
+        }
+
+        offset++;
+        if (label == 0)
+        {
+            name[used] = 0;
+            return end ? end : offset;
+        }
+
+        if ((offset + label > length) || (used + label + 2 > NAME_LENGTH_MAX))
+            return 0;
+        if (used > 0)
+            name[used++] = '.';
+        memcpy(name + used, data + offset, label);
+        used += label;
+        offset += label;
+    }
+
+    return 0;
+}
+
+static bool instance_is(const service_t *service, const char *name)
+{
+    char instance[NAME_LENGTH_MAX];
+
+    snprintf(instance, sizeof(instance), "%s.%s", service->instance, service->type);
+
+    return strcasecmp(instance, name) == 0;
+}
+
+static uint16_t read_u16(const uint8_t *data)
+{
+    return (data[0] << 8) | data[1];
+}
+
+static void handle_query(int sockfd, const uint8_t *data, size_t length, struct sockaddr_in *source)
+{
+    char name[NAME_LENGTH_MAX], target[NAME_LENGTH_MAX];
+    bool answer[SERVICE_COUNT][5] = { { false } };
+    bool known[SERVICE_COUNT] = { false };
+    struct sockaddr_in destination;
+    uint16_t questions, answers, type, count = 0;
+    size_t offset = 12, questions_end;
+    packet_t *packet;
+    bool legacy;
+    uint32_t ttl, known_ttl;
+    int i, j, suppressed = 0, known_count = 0;
+
+    if ((length < 12) || (read_u16(data + 2) & FLAG_RESPONSE))
+        return;
+
+    questions = read_u16(data + 4);
+    answers = read_u16(data + 6);
+    legacy = ntohs(source->sin_port) != MDNS_PORT;
+    ttl = legacy ? TTL_LEGACY_UNICAST : TTL;
+
+    // Questions, answer slots are PTR, SRV, TXT, A and AAAA
+    for (i = 0; i < questions; i++)
+    {
+        offset = read_name(data, length, offset, name);
+        if ((offset == 0) || (offset + 4 > length))
+            return;
+        type = read_u16(data + offset);
+        offset += 4;
+
+        for (j = 0; j < (int) SERVICE_COUNT; j++)
+        {
+            if ((type == TYPE_PTR) && (strcasecmp(name, services[j].type) == 0))
+                answer[j][0] = true;
+            if ((type == TYPE_SRV) && instance_is(&services[j], name))
+                answer[j][1] = true;
+            if ((type == TYPE_TXT) && instance_is(&services[j], name))
+                answer[j][2] = true;
+            if ((type == TYPE_A) && (strcasecmp(name, services[j].host) == 0))
+                answer[j][3] = true;
+            if ((type == TYPE_AAAA) && (strcasecmp(name, services[j].host) == 0))
+                answer[j][4] = true;
+        }
+    }
+    questions_end = offset;
+
+    // Known answers with at least half our TTL left suppress the PTR answer
+    for (i = 0; i < answers; i++)
+    {
+        offset = read_name(data, length, offset, name);
+        if ((offset == 0) || (offset + 10 > length))
+            return;
+        type = read_u16(data + offset);
+        known_ttl = ((uint32_t) read_u16(data + offset + 4) << 16) | read_u16(data + offset + 6);
+        offset += 10;
+        if (offset + read_u16(data + offset - 2) > length)
+            return;
+
+        if ((type == TYPE_PTR) && (read_name(data, length, offset, target) != 0))
+        {
+            known_count++;
+            for (j = 0; j < (int) SERVICE_COUNT; j++)
+            {
+                if ((strcasecmp(name, services[j].type) == 0) && instance_is(&services[j], target) &&
+                    (known_ttl >= ttl / 2))
+                    known[j] = true;
+            }
+        }
+        offset += read_u16(data + offset - 2);
+    }
+
+    packet = calloc(1, sizeof(packet_t));
+    if (packet == NULL)
+        return;
+
+    // Legacy unicast responses repeat query ID and questions
+    put_u16(packet, legacy ? read_u16(data) : 0);
+    put_u16(packet, FLAG_RESPONSE | FLAG_AUTHORITATIVE);
+    put_u16(packet, legacy ? questions : 0);
+    put_u16(packet, 0);
+    put_u16(packet, 0);
+    put_u16(packet, 0);
+    if (legacy)
+        put(packet, data + 12, questions_end - 12);
+
+    for (i = 0; i < (int) SERVICE_COUNT; i++)
+    {
+        if (answer[i][0] && known[i])
+        {
+            answer[i][0] = false;
+            suppressed++;
+        }
+        if (answer[i][0])
+        {
+            put_ptr(packet, &services[i], ttl);
+            count++;
+        }
+        if (answer[i][1])
+        {
+            put_srv(packet, &services[i], ttl);
+            count++;
+        }
+        if (answer[i][2])
+        {
+            put_txt(packet, &services[i], ttl);
+            count++;
+        }
+        if (answer[i][3])
+        {
+            put_address(packet, &services[i], AF_INET, ttl);
+            count++;
+        }
+        if (answer[i][4])
+        {
+            put_address(packet, &services[i], AF_INET6, ttl);
+            count++;
+        }
+    }
+    packet->data[6] = count >> 8;
+    packet->data[7] = count & 0xff;
+
+    // Everything needed to reach a service travels along with its PTR answer
+    count = 0;
+    for (i = 0; !split && (i < (int) SERVICE_COUNT); i++)
+    {
+        if (!answer[i][0])
+            continue;
+        put_srv(packet, &services[i], ttl);
+        put_txt(packet, &services[i], ttl);
+        put_address(packet, &services[i], AF_INET, ttl);
+        put_address(packet, &services[i], AF_INET6, ttl);
+        count += 4;
+    }
+    packet->data[10] = count >> 8;
+    packet->data[11] = count & 0xff;
+
+    printf("Query from %s:%u: %u question(s), %d known answer(s), %d suppressed, %u answer(s)\n",
+           inet_ntoa(source->sin_addr), ntohs(source->sin_port), questions, known_count, suppressed,
+           read_u16(packet->data + 6));
+
+    if (packet->full)
+        fprintf(stderr, "Response too large, not sent\n");
+    else if (read_u16(packet->data + 6) > 0)
+    {
+        destination = *source;
+        if (!legacy)
+        {
+            destination.sin_port = htons(MDNS_PORT);
+            inet_pton(AF_INET, MDNS_GROUP, &destination.sin_addr);
+        }
+        sendto(sockfd, packet->data, packet->length, 0, (struct sockaddr *) &destination, sizeof(destination));
+    }
+
+    free(packet);
+}
+
+int main(int argc, char *argv[])
+{
+    static uint8_t data[PACKET_SIZE];
+    struct sockaddr_in address, source;
+    struct ip_mreq membership;
+    socklen_t source_length;
+    ssize_t length;
+    int sockfd, option, one = 1;
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    memset(&membership, 0, sizeof(membership));
+    membership.imr_interface.s_addr = htonl(INADDR_ANY);
+
+    while ((option = getopt(argc, argv, "a:s")) != -1)
+    {
+        switch (option)
+        {
+            case 'a':
+                if (inet_pton(AF_INET, optarg, &membership.imr_interface) != 1)
+                {
+                    fprintf(stderr, "Invalid interface address %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 's': split = true; break;
+            default:
+                fprintf(stderr, "Usage: %s [-a interface address] [-s]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    // Shares the port with any other responder on this host
+    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(MDNS_PORT);
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    inet_pton(AF_INET, MDNS_GROUP, &membership.imr_multiaddr);
+
+    if ((bind(sockfd, (struct sockaddr *) &address, sizeof(address)) != 0) ||
+        (setsockopt(sockfd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) != 0))
+    {
+        perror("mdns-responder");
+        return 1;
+    }
+    setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_IF, &membership.imr_interface, sizeof(membership.imr_interface));
+
+    printf("Responding to mDNS queries on port %d%s\n", MDNS_PORT, split ? " (split mode)" : "");
+
+    while (1)
+    {
+        source_length = sizeof(source);
+        length = recvfrom(sockfd, data, sizeof(data), 0, (struct sockaddr *) &source, &source_length);
+        if (length > 0)
+            handle_query(sockfd, data, length, &source);
+    }
+
+    return 0;
+}